@@ -0,0 +1,164 @@
+#!/usr/bin/env python2
+# Copyright (c) 2017-2018 The SnowGem developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test dumptxoutset and loadtxoutset: a fresh node that only knows the
+# headers loads a snapshot taken by another node, ends up with the same
+# UTXO set, and keeps syncing from the snapshot block. Corrupt snapshots
+# and snapshots with an unexpected hash are rejected.
+#
+
+from test_framework.authproxy import JSONRPCException
+from test_framework.mininode import CBlockHeader, NodeConn, NodeConnCB, \
+    NetworkThread, msg_headers, msg_ping, msg_pong, mininode_lock
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, initialize_chain_clean, \
+    start_node, stop_node, connect_nodes_bi, sync_blocks, p2p_port
+
+import os
+import time
+from cStringIO import StringIO
+
+
+# A peer that only sends headers, and never answers requests for blocks
+class HeadersNode(NodeConnCB):
+    def __init__(self):
+        NodeConnCB.__init__(self)
+        self.create_callback_map()
+        self.connection = None
+        self.ping_counter = 1
+        self.last_pong = msg_pong()
+
+    def add_connection(self, conn):
+        self.connection = conn
+
+    def wait_for_verack(self):
+        while True:
+            with mininode_lock:
+                if self.verack_received:
+                    return
+            time.sleep(0.05)
+
+    def on_pong(self, conn, message):
+        self.last_pong = message
+
+    def sync_with_ping(self, timeout=30):
+        self.connection.send_message(msg_ping(nonce=self.ping_counter))
+        received_pong = False
+        sleep_time = 0.05
+        while not received_pong and timeout > 0:
+            time.sleep(sleep_time)
+            timeout -= sleep_time
+            with mininode_lock:
+                if self.last_pong.nonce == self.ping_counter:
+                    received_pong = True
+        self.ping_counter += 1
+        return received_pong
+
+
+class ChainstateSnapshotTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self):
+        # The nodes are only connected once node1 has loaded the snapshot
+        self.nodes = []
+        self.nodes.append(start_node(0, self.options.tmpdir, ["-debug"]))
+        self.nodes.append(start_node(1, self.options.tmpdir, ["-debug"]))
+        self.is_network_split = True
+
+    def assert_same_utxo_set(self):
+        for hash_type in ["hash_serialized", "muhash"]:
+            expected = self.nodes[0].gettxoutsetinfo(hash_type)
+            actual = self.nodes[1].gettxoutsetinfo(hash_type)
+            for key in ["bestblock", "height", "transactions", "txouts", "total_amount", hash_type]:
+                assert_equal(actual[key], expected[key])
+
+    def assert_load_fails(self, path, messages, *args):
+        if isinstance(messages, str):
+            messages = [messages]
+        height = self.nodes[1].getblockcount()
+        try:
+            self.nodes[1].loadtxoutset(path, *args)
+            raise AssertionError("loadtxoutset of %s succeeded" % path)
+        except JSONRPCException as e:
+            assert any(m in e.error['message'] for m in messages), e.error['message']
+        assert_equal(self.nodes[1].getblockcount(), height)
+
+    def run_test(self):
+        node0_address = self.nodes[0].getnewaddress()
+        self.nodes[0].generate(101)
+        self.nodes[0].sendtoaddress(node0_address, 1)
+        self.nodes[0].generate(1)
+        height = self.nodes[0].getblockcount()
+        snapshot = self.nodes[0].dumptxoutset("utxo.dat")
+        assert_equal(snapshot["bestblock"], self.nodes[0].getbestblockhash())
+        assert_equal(snapshot["height"], height)
+        assert_equal(snapshot["muhash"], self.nodes[0].gettxoutsetinfo("muhash")["muhash"])
+
+        # The snapshot block must be known before loading
+        self.assert_load_fails(snapshot["path"], "Unknown snapshot block")
+
+        # Give node1 the headers, but none of the blocks
+        headers_node = HeadersNode()
+        connection = NodeConn('127.0.0.1', p2p_port(1), self.nodes[1], headers_node)
+        headers_node.add_connection(connection)
+        NetworkThread().start()
+        headers_node.wait_for_verack()
+        headers = msg_headers()
+        for h in range(1, height + 1):
+            header = CBlockHeader()
+            header.deserialize(StringIO(self.nodes[0].getblockheader(self.nodes[0].getblockhash(h), False).decode('hex')))
+            headers.headers.append(header)
+        headers_node.connection.send_message(headers)
+        headers_node.sync_with_ping()
+        assert_equal(self.nodes[1].getblockheader(snapshot["bestblock"])["height"], height)
+        assert_equal(self.nodes[1].getblockcount(), 0)
+
+        # Snapshots with an unexpected hash, or that are corrupt, are rejected
+        self.assert_load_fails(snapshot["path"], "doesn't match", "00" * 32)
+        with open(snapshot["path"], "rb") as f:
+            data = f.read()
+        corrupt_path = os.path.join(self.options.tmpdir, "corrupt.dat")
+        with open(corrupt_path, "wb") as f:
+            pos = len(data) // 2
+            f.write(data[:pos] + chr(ord(data[pos]) ^ 0xff) + data[pos+1:])
+        # Depending on the byte, the file no longer parses or the checksum is off
+        self.assert_load_fails(corrupt_path, ["Invalid snapshot file", "checksum mismatch"])
+        truncated_path = os.path.join(self.options.tmpdir, "truncated.dat")
+        with open(truncated_path, "wb") as f:
+            f.write(data[:-16])
+        self.assert_load_fails(truncated_path, "checksum mismatch")
+
+        # The rejected snapshots left nothing behind, so the real one loads
+        loaded = self.nodes[1].loadtxoutset(snapshot["path"], snapshot["muhash"])
+        assert_equal(loaded["bestblock"], snapshot["bestblock"])
+        assert_equal(loaded["transactions"], snapshot["transactions"])
+        assert_equal(self.nodes[1].getbestblockhash(), snapshot["bestblock"])
+        self.assert_same_utxo_set()
+
+        # Only once
+        self.assert_load_fails(snapshot["path"], "must only have the genesis block")
+
+        # The snapshot survives a restart
+        stop_node(self.nodes[1], 1)
+        self.nodes[1] = start_node(1, self.options.tmpdir, ["-debug"])
+        assert_equal(self.nodes[1].getbestblockhash(), snapshot["bestblock"])
+        self.assert_same_utxo_set()
+
+        # Syncing continues from the snapshot block
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.is_network_split = False
+        self.nodes[0].sendtoaddress(node0_address, 1)
+        self.nodes[0].generate(5)
+        sync_blocks(self.nodes)
+        assert_equal(self.nodes[1].getblockcount(), height + 5)
+        self.assert_same_utxo_set()
+
+
+if __name__ == '__main__':
+    ChainstateSnapshotTest().main()
@@ -0,0 +1,73 @@
+#!/usr/bin/env python2
+# Copyright (c) 2017-2018 The SnowGem developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test that the mempool is written to mempool.dat on shutdown and
+# loaded again at startup, unless -persistmempool=0.
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, start_node, stop_node
+
+import time
+
+
+class MempoolPersistTest(BitcoinTestFramework):
+
+    def setup_network(self):
+        # Just need one node for this test
+        self.nodes = []
+        self.nodes.append(start_node(0, self.options.tmpdir))
+        self.is_network_split = False
+
+    def create_tx(self, from_txid, to_address, amount):
+        inputs = [{ "txid" : from_txid, "vout" : 0}]
+        outputs = { to_address : amount }
+        rawtx = self.nodes[0].createrawtransaction(inputs, outputs)
+        signresult = self.nodes[0].signrawtransaction(rawtx)
+        assert_equal(signresult["complete"], True)
+        return signresult["hex"]
+
+    def restart_node(self, extra_args=None):
+        stop_node(self.nodes[0], 0)
+        self.nodes[0] = start_node(0, self.options.tmpdir, extra_args)
+
+    def wait_for_mempool(self, txids):
+        # The mempool is loaded in the background
+        for i in range(100):
+            if len(self.nodes[0].getrawmempool()) == len(txids):
+                break
+            time.sleep(0.1)
+        assert_equal(set(self.nodes[0].getrawmempool()), set(txids))
+
+    def run_test(self):
+        node0_address = self.nodes[0].getnewaddress()
+        b = [ self.nodes[0].getblockhash(n) for n in range(1, 4) ]
+        coinbase_txids = [ self.nodes[0].getblock(h)['tx'][0] for h in b ]
+        spends_raw = [ self.create_tx(txid, node0_address, 10) for txid in coinbase_txids ]
+        spends_id = [ self.nodes[0].sendrawtransaction(tx) for tx in spends_raw ]
+        assert_equal(set(self.nodes[0].getrawmempool()), set(spends_id))
+
+        # The transactions survive a restart
+        self.restart_node()
+        self.wait_for_mempool(spends_id)
+
+        # Without -persistmempool the pool starts empty, and isn't written
+        # out on shutdown either
+        self.restart_node(["-persistmempool=0"])
+        assert_equal(self.nodes[0].getrawmempool(), [])
+        self.restart_node()
+        self.wait_for_mempool(spends_id)
+
+        # Mined transactions aren't loaded again
+        self.nodes[0].generate(1)
+        assert_equal(self.nodes[0].getrawmempool(), [])
+        self.restart_node()
+        time.sleep(1)
+        assert_equal(self.nodes[0].getrawmempool(), [])
+
+
+if __name__ == '__main__':
+    MempoolPersistTest().main()
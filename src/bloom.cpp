@@ -6,6 +6,7 @@
 
 #include "primitives/transaction.h"
 #include "hash.h"
+#include "memusage.h"
 #include "script/script.h"
 #include "script/standard.h"
 #include "random.h"
@@ -270,3 +271,59 @@ void CRollingBloomFilter::reset()
     b2.reset(nNewTweak);
     nInsertions = 0;
 }
+
+CBlockedBloomFilter::CBlockedBloomFilter(unsigned int nElementsIn) :
+    salt(GetRandHash()),
+    nElements(std::max(nElementsIn, 1u)),
+    nInsertions(0)
+{
+    size_t nBlocks = ((uint64_t)nElements * BITS_PER_ELEMENT + BLOCK_WORDS * 64 - 1) / (BLOCK_WORDS * 64);
+    vData.resize(nBlocks * BLOCK_WORDS);
+}
+
+size_t CBlockedBloomFilter::GetBlock(const uint256& hash, uint64_t (&vMask)[BLOCK_WORDS]) const
+{
+    uint64_t h = hash.GetHash(salt);
+    // The upper half of the hash selects the block...
+    size_t nBlocks = vData.size() / BLOCK_WORDS;
+    size_t nBlock = ((h >> 32) * nBlocks) >> 32;
+    // ...and the lower half the bits within it, by double hashing.
+    uint32_t nPos = h & 0xffff;
+    uint32_t nDelta = ((h >> 16) & 0xffff) | 1;
+    for (unsigned int i = 0; i < BLOCK_WORDS; i++)
+        vMask[i] = 0;
+    for (unsigned int i = 0; i < HASH_FUNCS; i++) {
+        uint32_t nBit = (nPos + i * nDelta) & (BLOCK_WORDS * 64 - 1);
+        vMask[nBit >> 6] |= (uint64_t)1 << (nBit & 63);
+    }
+    return nBlock * BLOCK_WORDS;
+}
+
+void CBlockedBloomFilter::insert(const uint256& hash)
+{
+    if (vData.empty())
+        return;
+    uint64_t vMask[BLOCK_WORDS];
+    size_t nFirst = GetBlock(hash, vMask);
+    for (unsigned int i = 0; i < BLOCK_WORDS; i++)
+        vData[nFirst + i] |= vMask[i];
+    nInsertions++;
+}
+
+bool CBlockedBloomFilter::contains(const uint256& hash) const
+{
+    if (vData.empty())
+        return true;
+    uint64_t vMask[BLOCK_WORDS];
+    size_t nFirst = GetBlock(hash, vMask);
+    for (unsigned int i = 0; i < BLOCK_WORDS; i++) {
+        if ((vData[nFirst + i] & vMask[i]) != vMask[i])
+            return false;
+    }
+    return true;
+}
+
+size_t CBlockedBloomFilter::DynamicMemoryUsage() const
+{
+    return memusage::DynamicUsage(vData);
+}
@@ -6,12 +6,13 @@
 #define BITCOIN_BLOOM_H
 
 #include "serialize.h"
+#include "uint256.h"
 
+#include <stdint.h>
 #include <vector>
 
 class COutPoint;
 class CTransaction;
-class uint256;
 
 //! 20,000 items with fp rate < 0.1% or 10,000 items and <0.0001%
 static const unsigned int MAX_BLOOM_FILTER_SIZE = 36000; // bytes
@@ -134,5 +135,53 @@ private:
     CBloomFilter b1, b2;
 };
 
+/**
+ * BlockedBloomFilter is a bloom filter over uint256 keys that sets all bits of
+ * a key within a single 512-bit block, so that a lookup touches one cache line
+ * instead of one per hash function. Keys are hashed with a random salt, which
+ * is serialized along with the filter.
+ *
+ * contains(key) always returns true if key was insert()'ed. For other keys it
+ * returns true with a probability well below 1%, as long as no more than
+ * nElements keys have been inserted. Keys can't be removed.
+ */
+class CBlockedBloomFilter
+{
+public:
+    CBlockedBloomFilter() : nElements(0), nInsertions(0) {}
+    CBlockedBloomFilter(unsigned int nElements);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(vData);
+        READWRITE(salt);
+        READWRITE(nElements);
+        READWRITE(nInsertions);
+    }
+
+    void insert(const uint256& hash);
+    bool contains(const uint256& hash) const;
+
+    //! Number of keys the filter was sized for
+    unsigned int GetCapacity() const { return nElements; }
+    //! Number of insert() calls so far, including repeated keys
+    unsigned int GetInsertions() const { return nInsertions; }
+    size_t DynamicMemoryUsage() const;
+
+private:
+    static const unsigned int BLOCK_WORDS = 8;
+    static const unsigned int BITS_PER_ELEMENT = 16;
+    static const unsigned int HASH_FUNCS = 8;
+
+    std::vector<uint64_t> vData;
+    uint256 salt;
+    unsigned int nElements;
+    unsigned int nInsertions;
+
+    //! Return the first word of the block of hash, and the mask of its bits in each word of the block.
+    size_t GetBlock(const uint256& hash, uint64_t (&vMask)[BLOCK_WORDS]) const;
+};
 
 #endif // BITCOIN_BLOOM_H
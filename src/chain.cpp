@@ -5,8 +5,50 @@
 
 #include "chain.h"
 
+#include "main.h"
+#include "sync.h"
+#include "txdb.h"
+
+#include <stdexcept>
+
 using namespace std;
 
+/**
+ * CBlockIndex implementation
+ */
+
+/** Guards the in-memory solutions against TrimSolution() for readers that don't hold cs_main. */
+static CCriticalSection cs_solution;
+
+bool CBlockIndex::HasSolution() const
+{
+    LOCK(cs_solution);
+    return !nSolution.empty();
+}
+
+void CBlockIndex::TrimSolution()
+{
+    AssertLockHeld(cs_main);
+    LOCK(cs_solution);
+    std::vector<unsigned char>().swap(nSolution);
+}
+
+std::vector<unsigned char> CBlockIndex::GetSolution() const
+{
+    {
+        LOCK(cs_solution);
+        if (!nSolution.empty())
+            return nSolution;
+    }
+
+    CDiskBlockIndex dbindex;
+    if (!pblocktree->ReadDiskBlockIndex(GetBlockHash(), dbindex)) {
+        LogPrintf("%s: failed to read index entry for block %s\n", __func__, GetBlockHash().ToString());
+        throw std::runtime_error("Failed to read block index entry from database");
+    }
+    return dbindex.nSolution;
+}
+
 /**
  * CChain implementation
  */
@@ -162,6 +162,11 @@ public:
     unsigned int nTime;
     unsigned int nBits;
     uint256 nNonce;
+
+    //! Equihash solution. Only held in memory until this entry has been
+    //! written to the block tree database; use GetSolution() to access it.
+    //! Once the entry is in mapBlockIndex it is only cleared with both
+    //! cs_main and the solution lock held, so either suffices to read it.
     std::vector<unsigned char> nSolution;
 
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
@@ -242,10 +247,22 @@ public:
         block.nTime          = nTime;
         block.nBits          = nBits;
         block.nNonce         = nNonce;
-        block.nSolution      = nSolution;
+        block.nSolution      = GetSolution();
         return block;
     }
 
+    //! Whether the Equihash solution of this block is held in memory.
+    bool HasSolution() const;
+
+    //! Return the Equihash solution of this block, reading it from the
+    //! block tree database if it is not held in memory.
+    std::vector<unsigned char> GetSolution() const;
+
+    //! Release the in-memory copy of the Equihash solution. Must only be
+    //! called once this entry has been written to the block tree database,
+    //! and with cs_main held.
+    void TrimSolution();
+
     uint256 GetBlockHash() const
     {
         return *phashBlock;
@@ -323,6 +340,8 @@ public:
 
     explicit CDiskBlockIndex(const CBlockIndex* pindex) : CBlockIndex(*pindex) {
         hashPrev = (pprev ? pprev->GetBlockHash() : uint256());
+        if (!HasSolution())
+            nSolution = pindex->GetSolution();
     }
 
     ADD_SERIALIZE_METHODS;
@@ -74,7 +74,7 @@ bool CCoinsViewBacked::GetStats(CCoinsStats &stats) const { return base->GetStat
 
 CCoinsKeyHasher::CCoinsKeyHasher() : salt(GetRandHash()) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), cachedCoinsUsage(0) { }
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), cachedCoinsUsage(0), nCoinsHits(0), nCoinsMisses(0) { }
 
 CCoinsViewCache::~CCoinsViewCache()
 {
@@ -90,8 +90,11 @@ size_t CCoinsViewCache::DynamicMemoryUsage() const {
 
 CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256 &txid) const {
     CCoinsMap::iterator it = cacheCoins.find(txid);
-    if (it != cacheCoins.end())
+    if (it != cacheCoins.end()) {
+        nCoinsHits++;
         return it;
+    }
+    nCoinsMisses++;
     CCoins tmp;
     if (!base->GetCoins(txid, tmp))
         return cacheCoins.end();
@@ -101,8 +104,10 @@ CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256 &txid) const
         // The parent only has an empty entry for this txid; we can consider our
         // version as fresh.
         ret->second.flags = CCoinsCacheEntry::FRESH;
+    } else {
+        ret->second.SetBase();
     }
-    cachedCoinsUsage += ret->second.coins.DynamicMemoryUsage();
+    cachedCoinsUsage += ret->second.DynamicMemoryUsage();
     return ret;
 }
 
@@ -144,6 +149,35 @@ bool CCoinsViewCache::GetNullifier(const uint256 &nullifier) const {
     return tmp;
 }
 
+bool CCoinsViewCache::WarmCoins(const uint256 &txid, CCoins &coins) {
+    if (cacheCoins.count(txid))
+        return false;
+    CCoinsMap::iterator ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry())).first;
+    coins.swap(ret->second.coins);
+    if (ret->second.coins.IsPruned()) {
+        // Same as in FetchCoins
+        ret->second.flags = CCoinsCacheEntry::FRESH;
+    } else {
+        ret->second.SetBase();
+    }
+    cachedCoinsUsage += ret->second.DynamicMemoryUsage();
+    return true;
+}
+
+bool CCoinsViewCache::WarmNullifier(const uint256 &nullifier, bool spent) {
+    if (cacheNullifiers.count(nullifier))
+        return false;
+    CNullifiersCacheEntry entry;
+    entry.entered = spent;
+    cacheNullifiers.insert(std::make_pair(nullifier, entry));
+    return true;
+}
+
+void CCoinsViewCache::GetHitStats(uint64_t &nHits, uint64_t &nMisses) const {
+    nHits = nCoinsHits;
+    nMisses = nCoinsMisses;
+}
+
 void CCoinsViewCache::PushAnchor(const ZCIncrementalMerkleTree &tree) {
     uint256 newrt = tree.root();
 
@@ -223,15 +257,34 @@ CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
         } else if (ret.first->second.coins.IsPruned()) {
             // The parent view only has a pruned entry for this; mark it as fresh.
             ret.first->second.flags = CCoinsCacheEntry::FRESH;
+        } else {
+            ret.first->second.SetBase();
         }
     } else {
-        cachedCoinUsage = ret.first->second.coins.DynamicMemoryUsage();
+        cachedCoinUsage = ret.first->second.DynamicMemoryUsage();
     }
     // Assume that whenever ModifyCoins is called, the entry will be modified.
     ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
     return CCoinsModifier(*this, ret.first, cachedCoinUsage);
 }
 
+CCoinsModifier CCoinsViewCache::ModifyNewCoins(const uint256 &txid) {
+    assert(!hasModifier);
+    std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
+    size_t cachedCoinUsage = 0;
+    if (ret.second) {
+        // Known not to be in the parent view, so don't look it up there.
+        ret.first->second.flags = CCoinsCacheEntry::FRESH;
+    } else {
+        // The entry was spent or disconnected in this view; the parent may
+        // still have it, so keep its flags and base.
+        cachedCoinUsage = ret.first->second.DynamicMemoryUsage();
+        ret.first->second.coins.Clear();
+    }
+    ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
+    return CCoinsModifier(*this, ret.first, cachedCoinUsage);
+}
+
 const CCoins* CCoinsViewCache::AccessCoins(const uint256 &txid) const {
     CCoinsMap::const_iterator it = FetchCoins(txid);
     if (it == cacheCoins.end()) {
@@ -267,6 +320,12 @@ void CCoinsViewCache::SetBestBlock(const uint256 &hashBlockIn) {
     hashBlock = hashBlockIn;
 }
 
+void CCoinsViewCache::ResetBestBlock() {
+    assert(cacheCoins.empty() && cacheAnchors.empty() && cacheNullifiers.empty());
+    hashBlock.SetNull();
+    hashAnchor.SetNull();
+}
+
 bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
                                  const uint256 &hashBlockIn,
                                  const uint256 &hashAnchorIn,
@@ -285,7 +344,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
                     assert(it->second.flags & CCoinsCacheEntry::FRESH);
                     CCoinsCacheEntry& entry = cacheCoins[it->first];
                     entry.coins.swap(it->second.coins);
-                    cachedCoinsUsage += entry.coins.DynamicMemoryUsage();
+                    cachedCoinsUsage += entry.DynamicMemoryUsage();
                     entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
                 }
             } else {
@@ -293,13 +352,13 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
                     // The grandparent does not have an entry, and the child is
                     // modified and being pruned. This means we can just delete
                     // it from the parent.
-                    cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
+                    cachedCoinsUsage -= itUs->second.DynamicMemoryUsage();
                     cacheCoins.erase(itUs);
                 } else {
                     // A normal modification.
-                    cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
+                    cachedCoinsUsage -= itUs->second.DynamicMemoryUsage();
                     itUs->second.coins.swap(it->second.coins);
-                    cachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
+                    cachedCoinsUsage += itUs->second.DynamicMemoryUsage();
                     itUs->second.flags |= CCoinsCacheEntry::DIRTY;
                 }
             }
@@ -360,9 +419,11 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
 
 bool CCoinsViewCache::Flush() {
     bool fOk = base->BatchWrite(cacheCoins, hashBlock, hashAnchor, cacheAnchors, cacheNullifiers);
-    cacheCoins.clear();
-    cacheAnchors.clear();
-    cacheNullifiers.clear();
+    // Start over with empty pools, which releases the memory of the old ones
+    // at once (clearing the maps would keep it for reuse).
+    CCoinsMap().swap(cacheCoins);
+    CAnchorsMap().swap(cacheAnchors);
+    CNullifiersMap().swap(cacheNullifiers);
     cachedCoinsUsage = 0;
     return fOk;
 }
@@ -484,6 +545,6 @@ CCoinsModifier::~CCoinsModifier()
         cache.cacheCoins.erase(it);
     } else {
         // If the coin still exists after the modification, add the new usage
-        cache.cachedCoinsUsage += it->second.coins.DynamicMemoryUsage();
+        cache.cachedCoinsUsage += it->second.DynamicMemoryUsage();
     }
 }
@@ -10,11 +10,14 @@
 #include "core_memusage.h"
 #include "memusage.h"
 #include "serialize.h"
+#include "support/allocators/pool.h"
 #include "uint256.h"
 
 #include <assert.h>
 #include <stdint.h>
 
+#include <functional>
+
 #include <boost/foreach.hpp>
 #include <boost/unordered_map.hpp>
 #include "snowgem/IncrementalMerkleTree.hpp"
@@ -288,12 +291,44 @@ struct CCoinsCacheEntry
     CCoins coins; // The actual cached data.
     unsigned char flags;
 
+    /**
+     * Which outputs are unspent in the parent view, and at which height, as
+     * of when the entry was read from it (unless it is FRESH). This lets a
+     * parent that stores outputs separately only write the ones that changed.
+     *
+     * It is only allocated for entries read from the parent, and is counted
+     * in DynamicMemoryUsage(), so -dbcache is still honoured. Up to 64
+     * outputs it costs one 8-byte allocation (32 bytes by MallocUsage) plus
+     * 40 bytes in the entry: about 20% more than a two-output P2PKH entry
+     * without it (~370 bytes against ~300), so a cache of a given size holds
+     * fewer such entries before it is flushed.
+     */
+    std::vector<bool> vBaseAvailable;
+    int nBaseHeight;
+
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
         FRESH = (1 << 1), // The parent view does not have this entry (or it is pruned).
     };
 
-    CCoinsCacheEntry() : coins(), flags(0) {}
+    CCoinsCacheEntry() : coins(), flags(0), nBaseHeight(0) {}
+
+    //! Record coins, as just read from the parent view, as its version of the entry
+    void SetBase() {
+        vBaseAvailable.resize(coins.vout.size());
+        for (unsigned int i = 0; i < coins.vout.size(); i++)
+            vBaseAvailable[i] = !coins.vout[i].IsNull();
+        nBaseHeight = coins.nHeight;
+    }
+
+    //! Whether output nPos is unspent in the parent view
+    bool IsBaseAvailable(unsigned int nPos) const {
+        return nPos < vBaseAvailable.size() && vBaseAvailable[nPos];
+    }
+
+    size_t DynamicMemoryUsage() const {
+        return coins.DynamicMemoryUsage() + memusage::DynamicUsage(vBaseAvailable);
+    }
 };
 
 struct CAnchorsCacheEntry
@@ -321,9 +356,18 @@ struct CNullifiersCacheEntry
     CNullifiersCacheEntry() : entered(false), flags(0) {}
 };
 
-typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
-typedef boost::unordered_map<uint256, CAnchorsCacheEntry, CCoinsKeyHasher> CAnchorsMap;
-typedef boost::unordered_map<uint256, CNullifiersCacheEntry, CCoinsKeyHasher> CNullifiersMap;
+/**
+ * The cache maps draw their nodes from a pool, which a CCoinsViewCache
+ * releases at once when it is flushed, and which tells the memory used by
+ * the maps themselves. The contents of the entries (such as the outputs of
+ * a CCoins) are still accounted for with DynamicMemoryUsage() estimates.
+ */
+typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher, std::equal_to<uint256>,
+                             PoolAllocator<std::pair<const uint256, CCoinsCacheEntry> > > CCoinsMap;
+typedef boost::unordered_map<uint256, CAnchorsCacheEntry, CCoinsKeyHasher, std::equal_to<uint256>,
+                             PoolAllocator<std::pair<const uint256, CAnchorsCacheEntry> > > CAnchorsMap;
+typedef boost::unordered_map<uint256, CNullifiersCacheEntry, CCoinsKeyHasher, std::equal_to<uint256>,
+                             PoolAllocator<std::pair<const uint256, CNullifiersCacheEntry> > > CNullifiersMap;
 
 struct CCoinsStats
 {
@@ -445,6 +489,10 @@ protected:
     /* Cached dynamic memory usage for the inner CCoins objects. */
     mutable size_t cachedCoinsUsage;
 
+    /* Number of coin lookups served from this cache, and that missed it. */
+    mutable uint64_t nCoinsHits;
+    mutable uint64_t nCoinsMisses;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
     ~CCoinsViewCache();
@@ -457,6 +505,8 @@ public:
     uint256 GetBestBlock() const;
     uint256 GetBestAnchor() const;
     void SetBestBlock(const uint256 &hashBlock);
+    //! Forget the best block and anchor, so that they are read from the base view again. The cache must be empty.
+    void ResetBestBlock();
     bool BatchWrite(CCoinsMap &mapCoins,
                     const uint256 &hashBlock,
                     const uint256 &hashAnchor,
@@ -475,6 +525,20 @@ public:
     // Marks a nullifier as spent or not.
     void SetNullifier(const uint256 &nullifier, bool spent);
 
+    /**
+     * Add coins that were read from the base view outside of this cache (e.g.
+     * prefetched on another thread), unless txid is already cached. The caller
+     * must ensure the base view hasn't been written to since. Returns whether
+     * the entry was added; coins is left empty if so.
+     */
+    bool WarmCoins(const uint256 &txid, CCoins &coins);
+
+    //! Like WarmCoins(), for the result of a nullifier lookup in the base view.
+    bool WarmNullifier(const uint256 &nullifier, bool spent);
+
+    //! Number of coin lookups served from this cache, and that missed it.
+    void GetHitStats(uint64_t &nHits, uint64_t &nMisses) const;
+
     /**
      * Return a pointer to CCoins in the cache, or NULL if not found. This is
      * more efficient than GetCoins. Modifications to other cache entries are
@@ -489,6 +553,17 @@ public:
      */
     CCoinsModifier ModifyCoins(const uint256 &txid);
 
+    /**
+     * Return a modifiable reference to a CCoins, for the outputs of a new
+     * transaction. Unlike ModifyCoins, this does not look the txid up in the
+     * parent view, which is a database miss for every new transaction while
+     * connecting blocks. It must only be used when the parent view is known
+     * not to have unspent outputs for txid: for non-coinbase transactions
+     * (their inputs could not be spent twice), and for coinbases once the
+     * BIP30 check in ConnectBlock passed.
+     */
+    CCoinsModifier ModifyNewCoins(const uint256 &txid);
+
     /**
      * Push the modifications applied to this cache to its base.
      * Failure to call this method before destruction will cause the changes to be forgotten.
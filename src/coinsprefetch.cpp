@@ -0,0 +1,227 @@
+// Copyright (c) 2017-2018 The SnowGem developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinsprefetch.h"
+
+#include "chain.h"
+#include "coins.h"
+#include "main.h"
+#include "primitives/block.h"
+#include "util.h"
+
+#include <deque>
+#include <list>
+#include <set>
+#include <stdexcept>
+
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+
+namespace {
+
+/** A block to read, queued by PrefetchBlock() */
+struct CPrefetchRequest
+{
+    uint256 hash;
+    CDiskBlockPos pos;
+    bool fCheckSolution;
+};
+
+/** A block read from disk, along with the coins and nullifiers it spends */
+struct CPrefetchedBlock
+{
+    uint256 hash;
+    CBlock block;
+    //! Generation of the coins database the entries below were read from
+    uint64_t nGeneration;
+    std::vector<std::pair<uint256, CCoins> > vCoins;
+    std::vector<std::pair<uint256, bool> > vNullifiers;
+};
+
+/**
+ * Reads the blocks about to be connected during initial block download
+ * ahead of time, so that ConnectTip neither waits for the disk nor for the
+ * coins database for the inputs of each block.
+ *
+ * Coins can only be read from the database while pcoinsTip is not being
+ * flushed to it, and are only valid until the next flush. Every flush bumps
+ * nGeneration, and anything read under an older generation is discarded.
+ */
+class CCoinsPrefetcher
+{
+private:
+    //! Maximum number of prefetched blocks waiting to be connected
+    static const size_t MAX_PREFETCHED = 2 * COINS_PREFETCH_DEPTH;
+
+    boost::mutex cs;
+    boost::condition_variable cond;
+    bool fRunning;
+    uint64_t nGeneration;
+    std::deque<CPrefetchRequest> queue;
+    //! Hashes of the blocks queued, being read or waiting to be connected
+    std::set<uint256> setRequested;
+    std::list<CPrefetchedBlock> listPrefetched;
+    CCoinsPrefetchStats stats;
+
+    void Read(const CPrefetchRequest& request, CCoinsView* pview, CPrefetchedBlock& result)
+    {
+        if (!ReadBlockFromDisk(result.block, request.pos, request.fCheckSolution))
+            throw std::runtime_error("failed to read block");
+        if (result.block.GetHash() != request.hash)
+            throw std::runtime_error("unexpected block hash");
+
+        std::set<uint256> setSeen;
+        BOOST_FOREACH(const CTransaction& tx, result.block.vtx) {
+            boost::this_thread::interruption_point();
+            if (!tx.IsCoinBase()) {
+                BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                    const uint256& txid = txin.prevout.hash;
+                    if (!setSeen.insert(txid).second)
+                        continue;
+                    CCoins coins;
+                    if (pview->GetCoins(txid, coins))
+                        result.vCoins.push_back(std::make_pair(txid, coins));
+                }
+            }
+            BOOST_FOREACH(const JSDescription& joinsplit, tx.vjoinsplit) {
+                BOOST_FOREACH(const uint256& nf, joinsplit.nullifiers) {
+                    result.vNullifiers.push_back(std::make_pair(nf, pview->GetNullifier(nf)));
+                }
+            }
+        }
+    }
+
+public:
+    CCoinsPrefetcher() : fRunning(false), nGeneration(0) {}
+
+    void Run(CCoinsView* pview)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            fRunning = true;
+        }
+        while (true) {
+            CPrefetchRequest request;
+            std::list<CPrefetchedBlock> listResult(1);
+            CPrefetchedBlock& result = listResult.front();
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                while (queue.empty())
+                    cond.wait(lock);
+                request = queue.front();
+                queue.pop_front();
+                result.hash = request.hash;
+                result.nGeneration = nGeneration;
+            }
+
+            try {
+                Read(request, pview, result);
+            } catch (const std::runtime_error& e) {
+                // ConnectTip will read the block itself and deal with any error
+                LogPrint("bench", "%s: skipping block %s: %s\n", __func__, request.hash.ToString(), e.what());
+                boost::unique_lock<boost::mutex> lock(cs);
+                setRequested.erase(request.hash);
+                continue;
+            }
+
+            boost::unique_lock<boost::mutex> lock(cs);
+            if (!setRequested.count(result.hash))
+                continue; // connected in the meantime
+            listPrefetched.splice(listPrefetched.end(), listResult);
+            stats.nBlocks++;
+            // Drop blocks that were never connected (e.g. after a reorganization)
+            while (listPrefetched.size() > MAX_PREFETCHED) {
+                setRequested.erase(listPrefetched.front().hash);
+                listPrefetched.pop_front();
+            }
+        }
+    }
+
+    void Schedule(const CBlockIndex* pindex)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (!fRunning || !(pindex->nStatus & BLOCK_HAVE_DATA))
+            return;
+        if (!setRequested.insert(pindex->GetBlockHash()).second)
+            return;
+        CPrefetchRequest request;
+        request.hash = pindex->GetBlockHash();
+        request.pos = pindex->GetBlockPos();
+        request.fCheckSolution = !pindex->IsValid(BLOCK_VALID_TREE);
+        queue.push_back(request);
+        cond.notify_one();
+    }
+
+    bool Take(const uint256& hash, CBlock& block, CCoinsViewCache& cache)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (!setRequested.erase(hash))
+            return false;
+        for (std::list<CPrefetchedBlock>::iterator it = listPrefetched.begin(); it != listPrefetched.end(); ++it) {
+            if (it->hash != hash)
+                continue;
+            block.vtx.swap(it->block.vtx);
+            static_cast<CBlockHeader&>(block) = it->block;
+            if (it->nGeneration == nGeneration) {
+                for (size_t i = 0; i < it->vCoins.size(); i++) {
+                    if (cache.WarmCoins(it->vCoins[i].first, it->vCoins[i].second))
+                        stats.nCoins++;
+                }
+                for (size_t i = 0; i < it->vNullifiers.size(); i++) {
+                    if (cache.WarmNullifier(it->vNullifiers[i].first, it->vNullifiers[i].second))
+                        stats.nNullifiers++;
+                }
+            } else {
+                stats.nStale++;
+            }
+            stats.nBlocksUsed++;
+            listPrefetched.erase(it);
+            return true;
+        }
+        // Still queued or being read; too late to be of any use.
+        return false;
+    }
+
+    void Invalidate()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        nGeneration++;
+    }
+
+    CCoinsPrefetchStats GetStats()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        return stats;
+    }
+};
+
+CCoinsPrefetcher prefetcher;
+
+} // anon namespace
+
+void ThreadCoinsPrefetch(CCoinsView* pcoinsdbview)
+{
+    RenameThread("snowgem-prefetch");
+    prefetcher.Run(pcoinsdbview);
+}
+
+void PrefetchBlock(const CBlockIndex* pindex)
+{
+    prefetcher.Schedule(pindex);
+}
+
+bool TakePrefetchedBlock(const uint256& hash, CBlock& block, CCoinsViewCache& cache)
+{
+    return prefetcher.Take(hash, block, cache);
+}
+
+void InvalidatePrefetchedCoins()
+{
+    prefetcher.Invalidate();
+}
+
+CCoinsPrefetchStats GetCoinsPrefetchStats()
+{
+    return prefetcher.GetStats();
+}
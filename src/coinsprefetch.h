@@ -0,0 +1,56 @@
+// Copyright (c) 2017-2018 The SnowGem developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSPREFETCH_H
+#define BITCOIN_COINSPREFETCH_H
+
+#include "uint256.h"
+
+#include <stdint.h>
+
+class CBlock;
+class CBlockIndex;
+class CCoinsView;
+class CCoinsViewCache;
+
+/** Number of blocks ahead of the one being connected to prefetch */
+static const int COINS_PREFETCH_DEPTH = 2;
+
+struct CCoinsPrefetchStats
+{
+    uint64_t nBlocks; //!< Blocks read ahead of time
+    uint64_t nBlocksUsed; //!< Prefetched blocks that were then connected
+    uint64_t nCoins; //!< Prefetched coins added to the coins cache
+    uint64_t nNullifiers; //!< Prefetched nullifiers added to the coins cache
+    uint64_t nStale; //!< Prefetched blocks whose coins were outdated by a flush
+
+    CCoinsPrefetchStats() : nBlocks(0), nBlocksUsed(0), nCoins(0), nNullifiers(0), nStale(0) {}
+};
+
+/**
+ * Run the prefetching thread, which reads blocks about to be connected from
+ * disk along with the coins and nullifiers they spend from pcoinsdbview.
+ */
+void ThreadCoinsPrefetch(CCoinsView* pcoinsdbview);
+
+/** Queue a block that is about to be connected for prefetching. cs_main must be held. */
+void PrefetchBlock(const CBlockIndex* pindex);
+
+/**
+ * If the block with the given hash has been prefetched, move it into block,
+ * add its prefetched coins and nullifiers to cache (which must be pcoinsTip)
+ * and return true. cs_main must be held.
+ */
+bool TakePrefetchedBlock(const uint256& hash, CBlock& block, CCoinsViewCache& cache);
+
+/**
+ * Forget about everything read from the coins database so far. Must be
+ * called, with cs_main held, whenever pcoinsTip has been flushed to it.
+ */
+void InvalidatePrefetchedCoins();
+
+/** Return the prefetching counters */
+CCoinsPrefetchStats GetCoinsPrefetchStats();
+
+#endif // BITCOIN_COINSPREFETCH_H
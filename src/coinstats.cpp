@@ -0,0 +1,177 @@
+// Copyright (c) 2017-2018 The SnowGem developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinstats.h"
+
+#include "clientversion.h"
+#include "coins.h"
+#include "crypto/sha256.h"
+#include "primitives/block.h"
+#include "streams.h"
+
+#include <algorithm>
+#include <ios>
+#include <set>
+
+#include <boost/foreach.hpp>
+
+namespace {
+
+const mpz_class& Modulus()
+{
+    static const mpz_class p = (mpz_class(1) << 3072) - 1103717;
+    return p;
+}
+
+/** Map data to a number modulo the prime, by expanding its SHA256 hash */
+mpz_class ToElement(const std::vector<unsigned char>& data)
+{
+    unsigned char seed[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data.empty() ? NULL : &data[0], data.size()).Finalize(seed);
+
+    unsigned char buf[MuHash3072::BYTE_SIZE];
+    for (unsigned char i = 0; i < MuHash3072::BYTE_SIZE / CSHA256::OUTPUT_SIZE; i++) {
+        CSHA256().Write(seed, sizeof(seed)).Write(&i, 1).Finalize(buf + i * CSHA256::OUTPUT_SIZE);
+    }
+    mpz_class x;
+    mpz_import(x.get_mpz_t(), sizeof(buf), -1, 1, 0, 0, buf);
+    // x < 2^3072 < 2p
+    if (x >= Modulus())
+        x -= Modulus();
+    return x;
+}
+
+std::vector<unsigned char> OutputElement(const uint256& txid, unsigned int n, const CCoins& coins, const CTxOut& out)
+{
+    uint32_t nCode = coins.nHeight * 2 + (coins.fCoinBase ? 1 : 0);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << txid;
+    ss << VARINT(n);
+    ss << VARINT(nCode);
+    ss << out;
+    return std::vector<unsigned char>(ss.begin(), ss.end());
+}
+
+bool IsUnspent(const CCoins* pcoins, unsigned int n)
+{
+    return pcoins && n < pcoins->vout.size() && !pcoins->vout[n].IsNull();
+}
+
+} // anon namespace
+
+MuHash3072::MuHash3072() : numerator(1), denominator(1) {}
+
+std::vector<unsigned char> MuHash3072::ToBytes(const mpz_class& value)
+{
+    std::vector<unsigned char> vch(BYTE_SIZE, 0);
+    size_t count = 0;
+    mpz_export(&vch[0], &count, -1, 1, 0, 0, value.get_mpz_t());
+    return vch;
+}
+
+mpz_class MuHash3072::FromBytes(const std::vector<unsigned char>& vch)
+{
+    if (vch.size() != BYTE_SIZE)
+        throw std::ios_base::failure("MuHash3072: invalid size");
+    mpz_class value;
+    mpz_import(value.get_mpz_t(), vch.size(), -1, 1, 0, 0, &vch[0]);
+    if (value == 0 || value >= Modulus())
+        throw std::ios_base::failure("MuHash3072: value out of range");
+    return value;
+}
+
+MuHash3072& MuHash3072::Insert(const std::vector<unsigned char>& data)
+{
+    numerator = numerator * ToElement(data) % Modulus();
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(const std::vector<unsigned char>& data)
+{
+    denominator = denominator * ToElement(data) % Modulus();
+    return *this;
+}
+
+uint256 MuHash3072::Finalize() const
+{
+    mpz_class inverse;
+    mpz_invert(inverse.get_mpz_t(), denominator.get_mpz_t(), Modulus().get_mpz_t());
+    std::vector<unsigned char> vch = ToBytes(numerator * inverse % Modulus());
+
+    uint256 hash;
+    CSHA256().Write(&vch[0], vch.size()).Finalize(hash.begin());
+    return hash;
+}
+
+void CUTXOStats::UpdateCoins(const uint256& txid, const CCoins* pold, const CCoins* pnew)
+{
+    if (pold && pold->IsPruned())
+        pold = NULL;
+    if (pnew && pnew->IsPruned())
+        pnew = NULL;
+    if (!pold && !pnew)
+        return;
+
+    if (pold) {
+        nTransactions--;
+        nSerializedSize -= 32 + ::GetSerializeSize(*pold, SER_DISK, CLIENT_VERSION);
+    }
+    if (pnew) {
+        nTransactions++;
+        nSerializedSize += 32 + ::GetSerializeSize(*pnew, SER_DISK, CLIENT_VERSION);
+    }
+
+    // Outputs that are unchanged needn't be hashed, unless the transaction
+    // they belong to was replaced altogether.
+    bool fSameTx = pold && pnew && pold->nHeight == pnew->nHeight && pold->fCoinBase == pnew->fCoinBase;
+    size_t nOutputs = std::max(pold ? pold->vout.size() : 0, pnew ? pnew->vout.size() : 0);
+    for (unsigned int i = 0; i < nOutputs; i++) {
+        bool fOld = IsUnspent(pold, i);
+        bool fNew = IsUnspent(pnew, i);
+        if (fSameTx && fOld && fNew && pold->vout[i] == pnew->vout[i])
+            continue;
+        if (fOld) {
+            const CTxOut& out = pold->vout[i];
+            nTransactionOutputs--;
+            nTotalAmount -= out.nValue;
+            muhash.Remove(OutputElement(txid, i, *pold, out));
+        }
+        if (fNew) {
+            const CTxOut& out = pnew->vout[i];
+            nTransactionOutputs++;
+            nTotalAmount += out.nValue;
+            muhash.Insert(OutputElement(txid, i, *pnew, out));
+        }
+    }
+}
+
+void UpdateUTXOStats(CUTXOStats& stats, const CBlock& block, const CCoinsViewCache& viewOld, const CCoinsViewCache& viewNew, bool fConnect)
+{
+    // Transactions created by the block don't exist before it is connected
+    // (ConnectBlock enforces BIP30) nor after it is disconnected, so only
+    // one side needs to be looked at.
+    std::set<uint256> setCreated;
+    std::set<uint256> setSpent;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        setCreated.insert(tx.GetHash());
+        if (tx.IsCoinBase())
+            continue;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+            setSpent.insert(txin.prevout.hash);
+        }
+    }
+
+    BOOST_FOREACH(const uint256& txid, setCreated) {
+        if (fConnect)
+            stats.UpdateCoins(txid, NULL, viewNew.AccessCoins(txid));
+        else
+            stats.UpdateCoins(txid, viewOld.AccessCoins(txid), NULL);
+    }
+    BOOST_FOREACH(const uint256& txid, setSpent) {
+        if (setCreated.count(txid))
+            continue;
+        stats.UpdateCoins(txid, viewOld.AccessCoins(txid), viewNew.AccessCoins(txid));
+    }
+    stats.hashBlock = viewNew.GetBestBlock();
+}
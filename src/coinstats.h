@@ -0,0 +1,113 @@
+// Copyright (c) 2017-2018 The SnowGem developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSTATS_H
+#define BITCOIN_COINSTATS_H
+
+#include "amount.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <stdint.h>
+#include <vector>
+
+#include <gmpxx.h>
+
+class CBlock;
+class CCoins;
+class CCoinsViewCache;
+class CTxOut;
+
+/**
+ * A hash of a set of byte strings that doesn't depend on the order in which
+ * they were added, and that elements can be removed from again.
+ *
+ * Each element is hashed to a number modulo the prime 2^3072 - 1103717, and
+ * the set is represented by the product of its elements. Removals multiply a
+ * separate denominator, so that the (expensive) modular inverse is only
+ * computed in Finalize().
+ */
+class MuHash3072
+{
+private:
+    mpz_class numerator;
+    mpz_class denominator;
+
+    static std::vector<unsigned char> ToBytes(const mpz_class& value);
+    static mpz_class FromBytes(const std::vector<unsigned char>& vch);
+
+public:
+    static const size_t BYTE_SIZE = 384;
+
+    MuHash3072();
+
+    MuHash3072& Insert(const std::vector<unsigned char>& data);
+    MuHash3072& Remove(const std::vector<unsigned char>& data);
+
+    //! Return the 256-bit hash of the set
+    uint256 Finalize() const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        std::vector<unsigned char> vchNumerator, vchDenominator;
+        if (!ser_action.ForRead()) {
+            vchNumerator = ToBytes(numerator);
+            vchDenominator = ToBytes(denominator);
+        }
+        READWRITE(vchNumerator);
+        READWRITE(vchDenominator);
+        if (ser_action.ForRead()) {
+            numerator = FromBytes(vchNumerator);
+            denominator = FromBytes(vchDenominator);
+        }
+    }
+};
+
+/**
+ * Statistics about the UTXO set at hashBlock, maintained as blocks are
+ * connected and disconnected. The counters match what scanning the coins
+ * database would give (see CCoinsViewDB::GetStats), and muhash covers every
+ * unspent output along with the height and coinbase flag of its transaction.
+ */
+struct CUTXOStats
+{
+    uint256 hashBlock;
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nSerializedSize;
+    CAmount nTotalAmount;
+    MuHash3072 muhash;
+
+    CUTXOStats() : nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
+
+    /**
+     * Account for the coins of transaction txid changing from pold to pnew.
+     * Either may be NULL or pruned if the transaction has no unspent outputs.
+     */
+    void UpdateCoins(const uint256& txid, const CCoins* pold, const CCoins* pnew);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(hashBlock);
+        READWRITE(nTransactions);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nSerializedSize);
+        READWRITE(nTotalAmount);
+        READWRITE(muhash);
+    }
+};
+
+/**
+ * Update stats for block having been connected (fConnect) or disconnected,
+ * where viewOld is the chainstate before and viewNew the one after. Only the
+ * coins of the transactions in the block and of the ones they spend are
+ * looked up, and all of those are already cached by viewOld and viewNew.
+ */
+void UpdateUTXOStats(CUTXOStats& stats, const CBlock& block, const CCoinsViewCache& viewOld, const CCoinsViewCache& viewNew, bool fConnect);
+
+#endif // BITCOIN_COINSTATS_H
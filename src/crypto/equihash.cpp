@@ -25,6 +25,7 @@
 #include <stdexcept>
 
 #include <boost/optional.hpp>
+#include <boost/thread/tss.hpp>
 
 EhSolverCancelledException solver_cancelled;
 
@@ -325,6 +326,129 @@ std::shared_ptr<eh_trunc> TruncatedStepRow<WIDTH>::GetTruncatedIndices(size_t le
 }
 
 #ifdef ENABLE_MINING
+/**
+ * Memory for the lists of OptimisedSolve. Each thread keeps its own across
+ * calls, so that solving doesn't go back to the allocator for every nonce.
+ */
+struct EhSolverArena
+{
+    std::unique_ptr<unsigned char[]> buffer;
+    size_t nSize;
+
+    EhSolverArena() : nSize(0) { }
+};
+
+static boost::thread_specific_ptr<EhSolverArena> solverArena;
+
+static EhSolverArena& GetSolverArena()
+{
+    if (!solverArena.get())
+        solverArena.reset(new EhSolverArena());
+    return *solverArena;
+}
+
+size_t EhSolverArenaSize()
+{
+    return solverArena.get() ? solverArena->nSize : 0;
+}
+
+void EhSolverArenaRelease()
+{
+    solverArena.reset();
+}
+
+/**
+ * List of rows in the solver arena. The rows created by a collision pass
+ * are first added as pending at the back of the buffer, and from there
+ * fill the slots of the rows they were made from, as the original
+ * algorithm did with a separate vector. Any left over are appended at the
+ * end of the round. The buffer only grows (by an eighth) if the list and
+ * the pending rows outgrow it.
+ */
+template<typename Row>
+class StepRowList
+{
+private:
+    EhSolverArena& arena;
+    Row* rows;
+    size_t nCapacity;
+    size_t nSize;
+    size_t nPending;
+
+    //! The k-th pending row; they are stored backwards from the end
+    Row* Pending(size_t k) { return rows + nCapacity - 1 - k; }
+
+    //! Grow the buffer, returning the old one to keep rows being copied valid
+    std::unique_ptr<unsigned char[]> Grow()
+    {
+        size_t nNewCapacity = nCapacity + nCapacity/8 + 1;
+        std::unique_ptr<unsigned char[]> buffer(new unsigned char[nNewCapacity * sizeof(Row)]);
+        Row* newRows = reinterpret_cast<Row*>(buffer.get());
+        std::copy(rows, rows + nSize, newRows);
+        std::copy(rows + nCapacity - nPending, rows + nCapacity, newRows + nNewCapacity - nPending);
+        LogPrint("pow", "Growing Equihash solver arena to %u rows\n", nNewCapacity);
+
+        std::swap(arena.buffer, buffer);
+        arena.nSize = nNewCapacity * sizeof(Row);
+        rows = newRows;
+        nCapacity = nNewCapacity;
+        return buffer;
+    }
+
+public:
+    StepRowList(EhSolverArena& arenaIn, size_t nReserve) : arena(arenaIn), nSize(0), nPending(0)
+    {
+        if (arena.nSize < nReserve * sizeof(Row)) {
+            arena.buffer.reset();
+            arena.buffer.reset(new unsigned char[nReserve * sizeof(Row)]);
+            arena.nSize = nReserve * sizeof(Row);
+        }
+        rows = reinterpret_cast<Row*>(arena.buffer.get());
+        nCapacity = arena.nSize / sizeof(Row);
+    }
+
+    size_t size() const { return nSize; }
+    Row& operator[](size_t i) { return rows[i]; }
+    Row* begin() { return rows; }
+    Row* end() { return rows + nSize; }
+
+    template<typename... Args>
+    void EmplaceBack(Args&&... args)
+    {
+        std::unique_ptr<unsigned char[]> old;
+        if (nSize + nPending == nCapacity)
+            old = Grow();
+        new (rows + nSize) Row(std::forward<Args>(args)...);
+        nSize++;
+    }
+
+    template<typename... Args>
+    Row& AddPending(Args&&... args)
+    {
+        std::unique_ptr<unsigned char[]> old;
+        if (nSize + nPending == nCapacity)
+            old = Grow();
+        return *new (Pending(nPending++)) Row(std::forward<Args>(args)...);
+    }
+
+    //! Discard the pending row added last
+    void DropPending() { nPending--; }
+    bool HasPending() const { return nPending > 0; }
+    //! Take the pending row added last; valid until the next one is added
+    Row& PopPending() { return *Pending(--nPending); }
+
+    //! Move the pending rows to the end of the list, in the order they were added
+    void AppendPending()
+    {
+        std::reverse(rows + nCapacity - nPending, rows + nCapacity);
+        std::copy(rows + nCapacity - nPending, rows + nCapacity, rows + nSize);
+        nSize += nPending;
+        nPending = 0;
+    }
+
+    void Truncate(size_t n) { nSize = n; }
+};
+
 template<unsigned int N, unsigned int K>
 bool Equihash<N,K>::BasicSolve(const eh_HashState& base_state,
                                const std::function<bool(std::vector<unsigned char>)> validBlock,
@@ -515,14 +639,14 @@ bool Equihash<N,K>::OptimisedSolve(const eh_HashState& base_state,
         LogPrint("pow", "Generating first list\n");
         size_t hashLen = HashLength;
         size_t lenIndices = sizeof(eh_trunc);
-        std::vector<TruncatedStepRow<TruncatedWidth>> Xt;
-        Xt.reserve(init_size);
+        // Rounds keep about init_size rows; leave room for the pending ones
+        StepRowList<TruncatedStepRow<TruncatedWidth>> Xt(GetSolverArena(), init_size + init_size/8);
         unsigned char tmpHash[HashOutput];
         for (eh_index g = 0; Xt.size() < init_size; g++) {
             GenerateHash(base_state, g, tmpHash, HashOutput);
             for (eh_index i = 0; i < IndicesPerHashOutput && Xt.size() < init_size; i++) {
-                Xt.emplace_back(tmpHash+(i*N/8), N/8, HashLength, CollisionBitLength,
-                                (g*IndicesPerHashOutput)+i, CollisionBitLength + 1);
+                Xt.EmplaceBack(tmpHash+(i*N/8), N/8, HashLength, CollisionBitLength,
+                               (g*IndicesPerHashOutput)+i, CollisionBitLength + 1);
             }
             if (cancelled(ListGeneration)) throw solver_cancelled;
         }
@@ -536,37 +660,34 @@ bool Equihash<N,K>::OptimisedSolve(const eh_HashState& base_state,
             if (cancelled(ListSorting)) throw solver_cancelled;
 
             LogPrint("pow", "- Finding collisions\n");
-            int i = 0;
-            int posFree = 0;
-            std::vector<TruncatedStepRow<TruncatedWidth>> Xc;
+            size_t i = 0;
+            size_t posFree = 0;
             while (i < Xt.size() - 1) {
                 // 2b) Find next set of unordered pairs with collisions on the next n/(k+1) bits
-                int j = 1;
+                size_t j = 1;
                 while (i+j < Xt.size() &&
                         HasCollision(Xt[i], Xt[i+j], CollisionByteLength)) {
                     j++;
                 }
 
                 // 2c) Calculate tuples (X_i ^ X_j, (i, j))
-                bool checking_for_zero = (i == 0 && Xt[0].IsZero(hashLen));
-                for (int l = 0; l < j - 1; l++) {
-                    for (int m = l + 1; m < j; m++) {
+                for (size_t l = 0; l < j - 1; l++) {
+                    for (size_t m = l + 1; m < j; m++) {
                         // We truncated, so don't check for distinct indices here
-                        TruncatedStepRow<TruncatedWidth> Xi {Xt[i+l], Xt[i+m],
-                                                             hashLen, lenIndices,
-                                                             CollisionByteLength};
-                        if (!(Xi.IsZero(hashLen-CollisionByteLength) &&
-                              IsProbablyDuplicate<soln_size>(Xi.GetTruncatedIndices(hashLen-CollisionByteLength, 2*lenIndices),
-                                                             2*lenIndices))) {
-                            Xc.emplace_back(Xi);
+                        TruncatedStepRow<TruncatedWidth>& Xi = Xt.AddPending(Xt[i+l], Xt[i+m],
+                                                                             hashLen, lenIndices,
+                                                                             CollisionByteLength);
+                        if (Xi.IsZero(hashLen-CollisionByteLength) &&
+                            IsProbablyDuplicate<soln_size>(Xi.GetTruncatedIndices(hashLen-CollisionByteLength, 2*lenIndices),
+                                                           2*lenIndices)) {
+                            Xt.DropPending();
                         }
                     }
                 }
 
                 // 2d) Store tuples on the table in-place if possible
-                while (posFree < i+j && Xc.size() > 0) {
-                    Xt[posFree++] = Xc.back();
-                    Xc.pop_back();
+                while (posFree < i+j && Xt.HasPending()) {
+                    Xt[posFree++] = Xt.PopPending();
                 }
 
                 i += j;
@@ -574,18 +695,16 @@ bool Equihash<N,K>::OptimisedSolve(const eh_HashState& base_state,
             }
 
             // 2e) Handle edge case where final table entry has no collision
-            while (posFree < Xt.size() && Xc.size() > 0) {
-                Xt[posFree++] = Xc.back();
-                Xc.pop_back();
+            while (posFree < Xt.size() && Xt.HasPending()) {
+                Xt[posFree++] = Xt.PopPending();
             }
 
-            if (Xc.size() > 0) {
+            if (Xt.HasPending()) {
                 // 2f) Add overflow to end of table
-                Xt.insert(Xt.end(), Xc.begin(), Xc.end());
+                Xt.AppendPending();
             } else if (posFree < Xt.size()) {
                 // 2g) Remove empty space at the end
-                Xt.erase(Xt.begin()+posFree, Xt.end());
-                Xt.shrink_to_fit();
+                Xt.Truncate(posFree);
             }
 
             hashLen -= CollisionByteLength;
@@ -625,7 +744,7 @@ bool Equihash<N,K>::OptimisedSolve(const eh_HashState& base_state,
         } else
             LogPrint("pow", "- List is empty\n");
 
-    } // Ensure Xt goes out of scope and is destroyed
+    } // Xt's rows stay in the arena for the next call
 
     LogPrint("pow", "Found %d partial solutions\n", partialSolns.size());
 
@@ -720,7 +839,7 @@ invalidsolution:
 #endif // ENABLE_MINING
 
 template<unsigned int N, unsigned int K>
-bool Equihash<N,K>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln)
+bool Equihash<N,K>::IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln)
 {
     if (soln.size() != SolutionWidth) {
         LogPrint("pow", "Invalid solution length: %d (expected %d)\n",
@@ -728,43 +847,67 @@ bool Equihash<N,K>::IsValidSolution(const eh_HashState& base_state, std::vector<
         return false;
     }
 
-    std::vector<FullStepRow<FinalFullWidth>> X;
-    X.reserve(1 << K);
+    // The tree is collapsed in place, in buffers of a size known at compile
+    // time, so that checking a solution doesn't touch the heap. After round r,
+    // rows[i] holds the XOR of the hashes of leaves i to i+2^(r+1)-1 for each
+    // node i, and the indices of a node are those of its leaves in order.
+    const size_t nIndices = 1 << K;
+    eh_index indices[nIndices];
+    {
+        unsigned char array[nIndices*sizeof(eh_index)];
+        ExpandArray(soln.data(), soln.size(), array, sizeof(array),
+                    CollisionBitLength+1, sizeof(eh_index) - ((CollisionBitLength+1)+7)/8);
+        for (size_t i = 0; i < nIndices; i++) {
+            indices[i] = ArrayToEhIndex(array+(i*sizeof(eh_index)));
+        }
+    }
+
+    // Two subtrees share an index if and only if the solution repeats an
+    // index, so check that once before doing any hashing.
+    {
+        eh_index sorted[nIndices];
+        std::copy(indices, indices+nIndices, sorted);
+        std::sort(sorted, sorted+nIndices);
+        if (std::adjacent_find(sorted, sorted+nIndices) != sorted+nIndices) {
+            LogPrint("pow", "Invalid solution: duplicate indices\n");
+            return false;
+        }
+    }
+
+    unsigned char rows[nIndices][HashLength];
     unsigned char tmpHash[HashOutput];
-    for (eh_index i : GetIndicesFromMinimal(soln, CollisionBitLength)) {
-        GenerateHash(base_state, i/IndicesPerHashOutput, tmpHash, HashOutput);
-        X.emplace_back(tmpHash+((i % IndicesPerHashOutput) * N/8),
-                       N/8, HashLength, CollisionBitLength, i);
+    for (size_t i = 0; i < nIndices; i++) {
+        GenerateHash(base_state, indices[i]/IndicesPerHashOutput, tmpHash, HashOutput);
+        ExpandArray(tmpHash+((indices[i] % IndicesPerHashOutput) * N/8), N/8,
+                    rows[i], HashLength, CollisionBitLength);
     }
 
-    size_t hashLen = HashLength;
-    size_t lenIndices = sizeof(eh_index);
-    while (X.size() > 1) {
-        std::vector<FullStepRow<FinalFullWidth>> Xc;
-        for (int i = 0; i < X.size(); i += 2) {
-            if (!HasCollision(X[i], X[i+1], CollisionByteLength)) {
+    for (size_t r = 0, nStep = 1; r < K; r++, nStep *= 2) {
+        const size_t pos = r*CollisionByteLength;
+        for (size_t i = 0; i < nIndices; i += 2*nStep) {
+            unsigned char* a = rows[i];
+            const unsigned char* b = rows[i+nStep];
+            if (memcmp(a+pos, b+pos, CollisionByteLength) != 0) {
                 LogPrint("pow", "Invalid solution: invalid collision length between StepRows\n");
-                LogPrint("pow", "X[i]   = %s\n", X[i].GetHex(hashLen));
-                LogPrint("pow", "X[i+1] = %s\n", X[i+1].GetHex(hashLen));
+                LogPrint("pow", "X[i]   = %s\n", HexStr(a+pos, a+HashLength));
+                LogPrint("pow", "X[i+1] = %s\n", HexStr(b+pos, b+HashLength));
                 return false;
             }
-            if (X[i+1].IndicesBefore(X[i], hashLen, lenIndices)) {
+            if (std::lexicographical_compare(indices+i+nStep, indices+i+2*nStep,
+                                             indices+i, indices+i+nStep)) {
                 LogPrint("pow", "Invalid solution: Index tree incorrectly ordered\n");
                 return false;
             }
-            if (!DistinctIndices(X[i], X[i+1], hashLen, lenIndices)) {
-                LogPrint("pow", "Invalid solution: duplicate indices\n");
-                return false;
-            }
-            Xc.emplace_back(X[i], X[i+1], hashLen, lenIndices, CollisionByteLength);
+            for (size_t j = pos+CollisionByteLength; j < HashLength; j++)
+                a[j] ^= b[j];
         }
-        X = Xc;
-        hashLen -= CollisionByteLength;
-        lenIndices *= 2;
     }
 
-    assert(X.size() == 1);
-    return X[0].IsZero(hashLen);
+    for (size_t j = K*CollisionByteLength; j < HashLength; j++) {
+        if (rows[0][j] != 0)
+            return false;
+    }
+    return true;
 }
 
 // Explicit instantiations for Equihash<96,3>
@@ -777,7 +920,7 @@ template bool Equihash<96,3>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(std::vector<unsigned char>)> validBlock,
                                              const std::function<bool(EhSolverCancelCheck)> cancelled);
 #endif
-template bool Equihash<96,3>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+template bool Equihash<96,3>::IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln);
 
 // Explicit instantiations for Equihash<200,9>
 template int Equihash<200,9>::InitialiseState(eh_HashState& base_state);
@@ -789,7 +932,7 @@ template bool Equihash<200,9>::OptimisedSolve(const eh_HashState& base_state,
                                               const std::function<bool(std::vector<unsigned char>)> validBlock,
                                               const std::function<bool(EhSolverCancelCheck)> cancelled);
 #endif
-template bool Equihash<200,9>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+template bool Equihash<200,9>::IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln);
 
 // Explicit instantiations for Equihash<96,5>
 template int Equihash<96,5>::InitialiseState(eh_HashState& base_state);
@@ -801,7 +944,7 @@ template bool Equihash<96,5>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(std::vector<unsigned char>)> validBlock,
                                              const std::function<bool(EhSolverCancelCheck)> cancelled);
 #endif
-template bool Equihash<96,5>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+template bool Equihash<96,5>::IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln);
 
 // Explicit instantiations for Equihash<48,5>
 template int Equihash<48,5>::InitialiseState(eh_HashState& base_state);
@@ -813,4 +956,4 @@ template bool Equihash<48,5>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(std::vector<unsigned char>)> validBlock,
                                              const std::function<bool(EhSolverCancelCheck)> cancelled);
 #endif
-template bool Equihash<48,5>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+template bool Equihash<48,5>::IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln);
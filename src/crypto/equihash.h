@@ -190,7 +190,7 @@ public:
                         const std::function<bool(std::vector<unsigned char>)> validBlock,
                         const std::function<bool(EhSolverCancelCheck)> cancelled);
 #endif
-    bool IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+    bool IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln);
 };
 
 #include "equihash.tcc"
@@ -214,6 +214,18 @@ static Equihash<48,5> Eh48_5;
     }
 
 #ifdef ENABLE_MINING
+/**
+ * Bytes the calling thread keeps for the first-phase lists of OptimisedSolve.
+ * This is not the peak memory of a solve, which also holds the (smaller)
+ * lists of the second phase and the candidate solutions.
+ */
+size_t EhSolverArenaSize();
+/**
+ * Free the arena of the calling thread. Threads that only solve once (and
+ * don't exit afterwards) should call this, so as not to keep it around.
+ */
+void EhSolverArenaRelease();
+
 inline bool EhBasicSolve(unsigned int n, unsigned int k, const eh_HashState& base_state,
                     const std::function<bool(std::vector<unsigned char>)> validBlock,
                     const std::function<bool(EhSolverCancelCheck)> cancelled)
@@ -391,3 +391,52 @@ TEST(checktransaction_tests, non_canonical_ed25519_signature) {
     EXPECT_CALL(state, DoS(100, false, REJECT_INVALID, "bad-txns-invalid-joinsplit-signature", false)).Times(1);
     CheckTransactionWithoutProofVerification(tx, state);
 }
+
+TEST(checktransaction_tests, deferred_joinsplit_signature_check) {
+    CMutableTransaction mtx = GetValidTransaction();
+    CTransaction validTx(mtx);
+    mtx.joinSplitSig[0] += 1;
+    CTransaction invalidTx(mtx);
+
+    std::vector<CJoinSplitSigCheck> vSigChecks;
+    {
+        // Signature checks are queued instead of performed
+        MockCValidationState state;
+        EXPECT_TRUE(CheckTransactionWithoutProofVerification(validTx, state, &vSigChecks));
+        EXPECT_TRUE(CheckTransactionWithoutProofVerification(invalidTx, state, &vSigChecks));
+        EXPECT_TRUE(CheckTransactionWithoutProofVerification(validTx, state, &vSigChecks));
+        ASSERT_EQ(vSigChecks.size(), 3);
+    }
+
+    EXPECT_TRUE(vSigChecks[0]());
+    EXPECT_FALSE(vSigChecks[1]());
+    EXPECT_EQ(vSigChecks[1].GetRejectReason(), "bad-txns-invalid-joinsplit-signature");
+    EXPECT_TRUE(vSigChecks[2]());
+
+    {
+        // The batch reports the invalid transaction
+        MockCValidationState state;
+        EXPECT_CALL(state, DoS(100, false, REJECT_INVALID, "bad-txns-invalid-joinsplit-signature", false)).Times(1);
+        EXPECT_FALSE(CheckJoinSplitSigs(vSigChecks, state));
+    }
+
+    {
+        // A batch of valid signatures passes
+        std::vector<CJoinSplitSigCheck> vValid;
+        vValid.push_back(CJoinSplitSigCheck(validTx));
+        vValid.push_back(CJoinSplitSigCheck(validTx));
+        MockCValidationState state;
+        EXPECT_TRUE(CheckJoinSplitSigs(vValid, state));
+    }
+
+    {
+        // Transactions without JoinSplits queue nothing
+        CMutableTransaction transparent = GetValidTransaction();
+        transparent.vjoinsplit.clear();
+        CTransaction tx(transparent);
+        std::vector<CJoinSplitSigCheck> vNone;
+        MockCValidationState state;
+        EXPECT_TRUE(CheckTransactionWithoutProofVerification(tx, state, &vNone));
+        EXPECT_TRUE(vNone.empty());
+    }
+}
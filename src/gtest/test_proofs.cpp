@@ -517,6 +517,67 @@ TEST(proofs, zksnark_serializes_properly)
     }
 }
 
+TEST(proofs, batch_verification)
+{
+    auto example = libsnark::generate_r1cs_example_with_field_input<curve_Fr>(250, 4);
+    example.constraint_system.swap_AB_if_beneficial();
+    auto kp = libsnark::r1cs_ppzksnark_generator<curve_pp>(example.constraint_system);
+    auto vkprecomp = libsnark::r1cs_ppzksnark_verifier_process_vk(kp.vk);
+
+    std::vector<libsnark::r1cs_ppzksnark_proof<curve_pp>> proofs;
+    for (size_t i = 0; i < 5; i++) {
+        proofs.push_back(libsnark::r1cs_ppzksnark_prover<curve_pp>(
+            kp.pk,
+            example.primary_input,
+            example.auxiliary_input,
+            example.constraint_system
+        ));
+    }
+
+    // An empty batch is valid
+    {
+        auto verifier = ProofVerifier::Batch();
+        ASSERT_TRUE(verifier.VerifyBatch());
+    }
+
+    // A batch of valid proofs is valid
+    {
+        auto verifier = ProofVerifier::Batch();
+        for (auto& proof : proofs) {
+            ASSERT_TRUE(verifier.check(kp.vk, vkprecomp, example.primary_input, proof));
+        }
+        ASSERT_TRUE(verifier.VerifyBatch());
+    }
+
+    // A single invalid proof makes the whole batch invalid
+    for (size_t i = 0; i < 5; i++) {
+        auto badproof = ZCProof::random_invalid().to_libsnark_proof<libsnark::r1cs_ppzksnark_proof<curve_pp>>();
+        auto verifier = ProofVerifier::Batch();
+        for (size_t j = 0; j < proofs.size(); j++) {
+            ASSERT_TRUE(verifier.check(kp.vk, vkprecomp, example.primary_input, j == i ? badproof : proofs[j]));
+        }
+        ASSERT_FALSE(verifier.VerifyBatch());
+    }
+
+    // So does a valid proof used with a different primary input
+    {
+        auto input = example.primary_input;
+        input[0] = input[0] + curve_Fr::one();
+        auto verifier = ProofVerifier::Batch();
+        ASSERT_TRUE(verifier.check(kp.vk, vkprecomp, example.primary_input, proofs[0]));
+        ASSERT_TRUE(verifier.check(kp.vk, vkprecomp, input, proofs[1]));
+        ASSERT_FALSE(verifier.VerifyBatch());
+    }
+
+    // Primary inputs of the wrong size are rejected when added
+    {
+        auto input = example.primary_input;
+        input.push_back(curve_Fr::one());
+        auto verifier = ProofVerifier::Batch();
+        ASSERT_FALSE(verifier.check(kp.vk, vkprecomp, input, proofs[0]));
+    }
+}
+
 TEST(proofs, g1_deserialization)
 {
     CompressedG1 g;
@@ -31,8 +31,11 @@ class CLevelDBBatch
 
 private:
     leveldb::WriteBatch batch;
+    size_t size_estimate;
 
 public:
+    CLevelDBBatch() : size_estimate(0) {}
+
     template <typename K, typename V>
     void Write(const K& key, const V& value)
     {
@@ -47,6 +50,7 @@ public:
         leveldb::Slice slValue(&ssValue[0], ssValue.size());
 
         batch.Put(slKey, slValue);
+        size_estimate += slKey.size() + slValue.size();
     }
 
     template <typename K>
@@ -58,6 +62,16 @@ public:
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
         batch.Delete(slKey);
+        size_estimate += slKey.size();
+    }
+
+    //! Approximate number of bytes of keys and values in the batch
+    size_t SizeEstimate() const { return size_estimate; }
+
+    void Clear()
+    {
+        batch.Clear();
+        size_estimate = 0;
     }
 };
 
@@ -168,6 +182,12 @@ public:
     {
         return pdb->NewIterator(iteroptions);
     }
+
+    //! Iterator for lookups of a few entries, which fills the block cache like Read() does
+    leveldb::Iterator* NewReadIterator() const
+    {
+        return pdb->NewIterator(readoptions);
+    }
 };
 
 #endif // BITCOIN_LEVELDBWRAPPER_H
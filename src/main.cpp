@@ -13,8 +13,11 @@
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "coinsprefetch.h"
+#include "coinstats.h"
 #include "consensus/validation.h"
 #include "deprecation.h"
+#include "hash.h"
 #include "init.h"
 #include "masternode-budget.h"
 #include "masternode-payments.h"
@@ -24,6 +27,7 @@
 #include "net.h"
 #include "obfuscation.h"
 #include "pow.h"
+#include "proofcache.h"
 #include "spork.h"
 #include "sporkdb.h"
 #include "swifttx.h"
@@ -37,6 +41,7 @@
 #include "wallet/asyncrpcoperation_sendmany.h"
 #include "wallet/asyncrpcoperation_shieldcoinbase.h"
 
+#include <algorithm>
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
@@ -76,6 +81,7 @@ bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = true;
 bool fCoinbaseEnforcedProtectionEnabled = true;
 size_t nCoinCacheUsage = 5000 * 300;
+int nAnchorHistory = DEFAULT_ANCHOR_HISTORY;
 uint64_t nPruneTarget = 0;
 
 bool fAlerts = DEFAULT_ALERTS;
@@ -558,9 +564,18 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewDB *pcoinsdbview = NULL;
 CBlockTreeDB *pblocktree = NULL;
 CSporkDB* pSporkDB = NULL;
 
+CBlockIndex *pindexSnapshot = NULL;
+/** Whether a chainstate snapshot is being loaded, during which no blocks are connected (protected by cs_main) */
+static bool fLoadingSnapshot = false;
+
+/** Statistics about pcoinsTip, kept up to date by ConnectTip and DisconnectTip once loaded (protected by cs_main) */
+static CUTXOStats utxoStats;
+static bool fUTXOStatsLoaded = false;
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // mapOrphanTransactions
@@ -900,14 +915,15 @@ int GetIXConfirmations(uint256 nTXHash)
 }
 
 bool CheckTransaction(const CTransaction& tx, CValidationState &state,
-                      libsnowgem::ProofVerifier& verifier)
+                      libsnowgem::ProofVerifier& verifier,
+                      std::vector<CJoinSplitSigCheck> *pvSigChecks)
 {
     // Don't count coinbase transactions because mining skews the count
     if (!tx.IsCoinBase()) {
         transactionsValidated.increment();
     }
 
-    if (!CheckTransactionWithoutProofVerification(tx, state)) {
+    if (!CheckTransactionWithoutProofVerification(tx, state, pvSigChecks)) {
         return false;
     } else {
         // Ensure that zk-SNARKs verify
@@ -921,7 +937,8 @@ bool CheckTransaction(const CTransaction& tx, CValidationState &state,
     }
 }
 
-bool CheckTransactionWithoutProofVerification(const CTransaction& tx, CValidationState &state)
+bool CheckTransactionWithoutProofVerification(const CTransaction& tx, CValidationState &state,
+                                              std::vector<CJoinSplitSigCheck> *pvSigChecks)
 {
     // Basic checks that don't depend on any context
 
@@ -1058,33 +1075,155 @@ bool CheckTransactionWithoutProofVerification(const CTransaction& tx, CValidatio
                                  REJECT_INVALID, "bad-txns-prevout-null");
 
         if (tx.vjoinsplit.size() > 0) {
-            // Empty output script.
-            CScript scriptCode;
-            uint256 dataToBeSigned;
-            try {
-                dataToBeSigned = SignatureHash(scriptCode, tx, NOT_AN_INPUT, SIGHASH_ALL);
-            } catch (std::logic_error ex) {
-                return state.DoS(100, error("CheckTransaction(): error computing signature hash"),
-                                 REJECT_INVALID, "error-computing-signature-hash");
+            CJoinSplitSigCheck check(tx);
+            if (pvSigChecks != NULL) {
+                pvSigChecks->push_back(CJoinSplitSigCheck());
+                check.swap(pvSigChecks->back());
+            } else if (!check()) {
+                return state.DoS(100, false, REJECT_INVALID, check.GetRejectReason());
             }
+        }
+    }
+
+    return true;
+}
+
+bool CJoinSplitSigCheck::operator()() {
+    // Empty output script.
+    CScript scriptCode;
+    uint256 dataToBeSigned;
+    try {
+        dataToBeSigned = SignatureHash(scriptCode, *ptx, NOT_AN_INPUT, SIGHASH_ALL);
+    } catch (std::logic_error ex) {
+        strRejectReason = "error-computing-signature-hash";
+        return ::error("CheckTransaction(): %s error computing signature hash", ptx->GetHash().ToString());
+    }
+
+    BOOST_STATIC_ASSERT(crypto_sign_PUBLICKEYBYTES == 32);
+
+    // We rely on libsodium to check that the signature is canonical.
+    // https://github.com/jedisct1/libsodium/commit/62911edb7ff2275cccd74bf1c8aefcc4d76924e0
+    if (crypto_sign_verify_detached(&ptx->joinSplitSig[0],
+                                    dataToBeSigned.begin(), 32,
+                                    ptx->joinSplitPubKey.begin()
+                                   ) != 0) {
+        strRejectReason = "bad-txns-invalid-joinsplit-signature";
+        return ::error("CheckTransaction(): %s invalid joinsplit signature", ptx->GetHash().ToString());
+    }
+    return true;
+}
+
+static CCheckQueue<CJoinSplitSigCheck> joinsplitsigcheckqueue(128);
+// CheckBlock is also called without cs_main held, so the queue needs its own lock
+static boost::mutex cs_joinsplitsigcheckqueue;
+
+void ThreadJoinSplitSigCheck() {
+    RenameThread("snowgem-jssigch");
+    joinsplitsigcheckqueue.Thread();
+}
+
+bool CheckJoinSplitSigs(std::vector<CJoinSplitSigCheck>& vSigChecks, CValidationState& state)
+{
+    if (nScriptCheckThreads && vSigChecks.size() > 1) {
+        std::vector<CJoinSplitSigCheck> vQueued(vSigChecks);
+        boost::lock_guard<boost::mutex> lock(cs_joinsplitsigcheckqueue);
+        CCheckQueueControl<CJoinSplitSigCheck> control(&joinsplitsigcheckqueue);
+        control.Add(vQueued);
+        if (control.Wait())
+            return true;
+    }
+
+    // Either there are no workers, or a signature is invalid and we need
+    // to find out which transaction it belongs to.
+    BOOST_FOREACH(CJoinSplitSigCheck& check, vSigChecks) {
+        if (!check())
+            return state.DoS(100, false, REJECT_INVALID, check.GetRejectReason());
+    }
+    return true;
+}
+
+// Loose transactions are checked without cs_main, concurrently with
+// ConnectBlock, so they get a queue (and lock) of their own.
+static CCheckQueue<CProofCheck> txproofcheckqueue(1);
+static boost::mutex cs_txproofcheckqueue;
+
+void ThreadTxProofCheck() {
+    RenameThread("snowgem-txproof");
+    txproofcheckqueue.Thread();
+}
+
+/**
+ * Transactions whose joinSplitSig was verified by PreCheckTransaction. The
+ * txid commits to the signature and to everything it signs, so
+ * AcceptToMemoryPool needn't verify it again; the proofs are found in the
+ * proof cache.
+ */
+static std::set<uint256> setPreCheckedTx;
+static CCriticalSection cs_setPreCheckedTx;
+static const unsigned int MAX_PRECHECKED_TX = 1000;
+
+static CMempoolAcceptStats mempoolAcceptStats;
+static CCriticalSection cs_mempoolAcceptStats;
 
-            BOOST_STATIC_ASSERT(crypto_sign_PUBLICKEYBYTES == 32);
+bool PreCheckTransaction(const CTransaction& tx, CValidationState& state)
+{
+    if (tx.vjoinsplit.empty())
+        return true;
+
+    int64_t nTimeStart = GetTimeMicros();
+    std::vector<CJoinSplitSigCheck> vSigChecks;
+    if (!CheckTransactionWithoutProofVerification(tx, state, &vSigChecks))
+        return error("PreCheckTransaction: CheckTransaction failed");
+
+    // One check per JoinSplit, so that the workers share the proofs of the
+    // transaction while the signature is verified here.
+    std::vector<CProofCheck> vProofChecks(tx.vjoinsplit.size(), CProofCheck(true));
+    for (unsigned int js = 0; js < tx.vjoinsplit.size(); js++)
+        vProofChecks[js].Add(tx, js);
 
-            // We rely on libsodium to check that the signature is canonical.
-            // https://github.com/jedisct1/libsodium/commit/62911edb7ff2275cccd74bf1c8aefcc4d76924e0
-            if (crypto_sign_verify_detached(&tx.joinSplitSig[0],
-                                            dataToBeSigned.begin(), 32,
-                                            tx.joinSplitPubKey.begin()
-                                           ) != 0) {
-                return state.DoS(100, error("CheckTransaction(): invalid joinsplit signature"),
-                                 REJECT_INVALID, "bad-txns-invalid-joinsplit-signature");
+    bool fProofsOk = true;
+    {
+        boost::lock_guard<boost::mutex> lock(cs_txproofcheckqueue);
+        CCheckQueueControl<CProofCheck> control(nScriptCheckThreads ? &txproofcheckqueue : NULL);
+        if (nScriptCheckThreads)
+            control.Add(vProofChecks);
+        if (!CheckJoinSplitSigs(vSigChecks, state))
+            return error("PreCheckTransaction: CheckTransaction failed");
+        if (nScriptCheckThreads) {
+            fProofsOk = control.Wait();
+        } else {
+            BOOST_FOREACH(CProofCheck& check, vProofChecks) {
+                if (!check()) {
+                    fProofsOk = false;
+                    break;
+                }
             }
         }
     }
+    if (!fProofsOk)
+        return state.DoS(100, error("PreCheckTransaction: joinsplit does not verify"),
+                         REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
 
+    {
+        LOCK(cs_setPreCheckedTx);
+        if (setPreCheckedTx.size() >= MAX_PRECHECKED_TX)
+            setPreCheckedTx.clear();
+        setPreCheckedTx.insert(tx.GetHash());
+    }
+    {
+        LOCK(cs_mempoolAcceptStats);
+        mempoolAcceptStats.nPreChecked++;
+        mempoolAcceptStats.nPreCheckTime += GetTimeMicros() - nTimeStart;
+    }
     return true;
 }
 
+CMempoolAcceptStats GetMempoolAcceptStats()
+{
+    LOCK(cs_mempoolAcceptStats);
+    return mempoolAcceptStats;
+}
+
 CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowFree)
 {
     {
@@ -1114,9 +1253,40 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
     return nMinFee;
 }
 
+/** Drop transactions older than age seconds, then trim the pool to limit bytes of memory */
+static void LimitMempoolSize(CTxMemPool& pool, size_t limit, int64_t age)
+{
+    int expired = pool.Expire(GetTime() - age);
+    if (expired != 0)
+        LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
+
+    pool.TrimToSize(limit);
+}
+
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectAbsurdFee, bool ignoreFees)
+{
+    return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), fRejectAbsurdFee, ignoreFees);
+}
+
+static bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree, bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectAbsurdFee, bool ignoreFees);
+
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree, bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectAbsurdFee, bool ignoreFees)
 {
     AssertLockHeld(cs_main);
+    int64_t nTimeStart = GetTimeMicros();
+    bool fAccepted = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, fRejectAbsurdFee, ignoreFees);
+    if (fAccepted) {
+        int64_t nTime = GetTimeMicros() - nTimeStart;
+        LogPrint("bench", "    - Accept %s: %.2fms\n", tx.GetHash().ToString(), nTime * 0.001);
+        LOCK(cs_mempoolAcceptStats);
+        mempoolAcceptStats.nAccepted++;
+        mempoolAcceptStats.nLockedTime += nTime;
+    }
+    return fAccepted;
+}
+
+static bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree, bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectAbsurdFee, bool ignoreFees)
+{
     if (pfMissingInputs)
         *pfMissingInputs = false;
 
@@ -1131,9 +1301,26 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         }
     }
 
-    auto verifier = libsnowgem::ProofVerifier::Strict();
-    if (!CheckTransaction(tx, state, verifier))
+    // JoinSplit proofs are verified through the proof cache below, so that
+    // ConnectBlock can skip them when this transaction is mined.
+    auto verifier = libsnowgem::ProofVerifier::Disabled();
+    std::vector<CJoinSplitSigCheck> vSigChecks;
+    if (!CheckTransaction(tx, state, verifier, &vSigChecks))
         return error("AcceptToMemoryPool: CheckTransaction failed");
+    if (!vSigChecks.empty()) {
+        bool fPreChecked;
+        {
+            LOCK(cs_setPreCheckedTx);
+            fPreChecked = setPreCheckedTx.erase(tx.GetHash()) != 0;
+        }
+        if (!fPreChecked && !CheckJoinSplitSigs(vSigChecks, state))
+            return error("AcceptToMemoryPool: CheckTransaction failed");
+    }
+    BOOST_FOREACH(const JSDescription &joinsplit, tx.vjoinsplit) {
+        if (!CachingVerifyJoinSplit(joinsplit, tx.joinSplitPubKey, true))
+            return state.DoS(100, error("AcceptToMemoryPool: joinsplit does not verify"),
+                             REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
+    }
 
     // Coinbase is only valid in a block, not as a loose transaction
     if (tx.IsCoinBase())
@@ -1245,7 +1432,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         CAmount nFees = nValueIn-nValueOut;
         double dPriority = view.GetPriority(tx, chainActive.Height());
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), mempool.HasNoInputsOf(tx));
+        CTxMemPoolEntry entry(tx, nFees, nAcceptTime, dPriority, chainActive.Height(), mempool.HasNoInputsOf(tx));
         unsigned int nSize = entry.GetTxSize();
 
         // Accept a tx if it contains joinsplits and has at least the default fee specified by z_sendmany.
@@ -1273,6 +1460,19 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                                 REJECT_INSUFFICIENTFEE, "insufficient fee");
         }
 
+        // Don't accept it if the pool is full and it doesn't pay more than
+        // the transactions that were evicted to make room
+        if (!ignoreFees) {
+            CAmount nModifiedFees = nFees;
+            double dPriorityDummy = 0;
+            pool.ApplyDeltas(hash, dPriorityDummy, nModifiedFees);
+            CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+            if (fLimitFree && mempoolRejectFee > 0 && nModifiedFees < mempoolRejectFee)
+                return state.DoS(0, error("AcceptToMemoryPool: mempool min fee not met %s, %d < %d",
+                                        hash.ToString(), nModifiedFees, mempoolRejectFee),
+                                REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+        }
+
         // Require that free transactions have sufficient priority to be mined in the next block.
         if (GetBoolArg("-relaypriority", false) && nFees < ::minRelayTxFee.GetFee(nSize) && !AllowFree(view.GetPriority(tx, chainActive.Height() + 1))) {
             return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "insufficient priority");
@@ -1307,6 +1507,19 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                          hash.ToString(),
                          nFees, ::minRelayTxFee.GetFee(nSize) * 10000);
 
+        // Keep the chains of unconfirmed transactions short, as every
+        // transaction joining one updates the package state of the others
+        CTxMemPoolEntry::Links setAncestors;
+        std::string errString;
+        if (!pool.CalculateMemPoolAncestors(entry, setAncestors,
+                                            GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT),
+                                            GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT) * 1000,
+                                            GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT),
+                                            GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000,
+                                            errString))
+            return state.DoS(0, error("AcceptToMemoryPool: %s %s", errString, hash.ToString()),
+                             REJECT_NONSTANDARD, "too-long-mempool-chain");
+
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
         if (!ContextualCheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true, Params().GetConsensus()))
@@ -1330,6 +1543,11 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
 
         // Store transaction in memory
         pool.addUnchecked(hash, entry, !IsInitialBlockDownload());
+
+        // Trim the pool, which may evict the transaction we just added
+        LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        if (!pool.exists(hash))
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
     }
 
     SyncWithWallets(tx, NULL);
@@ -1612,7 +1830,7 @@ bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos, const CMessageHeader::M
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, bool fCheckSolution)
 {
     block.SetNull();
 
@@ -1630,7 +1848,7 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
     }
 
     // Check the header
-    if (!(CheckEquihashSolution(&block, Params()) &&
+    if (!((!fCheckSolution || CheckEquihashSolution(&block, Params())) &&
           CheckProofOfWork(block.GetHash(), block.nBits, Params().GetConsensus())))
         return error("ReadBlockFromDisk: Errors in block header at %s", pos.ToString());
 
@@ -1639,7 +1857,11 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
 
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos()))
+    // The Equihash solution of a header that made it to BLOCK_VALID_TREE was
+    // checked when the header was accepted. The hash comparison below ensures
+    // that we read back exactly that header, so don't verify it again.
+    bool fCheckSolution = !pindex->IsValid(BLOCK_VALID_TREE);
+    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), fCheckSolution))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
@@ -1882,7 +2104,7 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
     }
 
     // add outputs
-    inputs.ModifyCoins(tx.GetHash())->FromTx(tx, nHeight);
+    inputs.ModifyNewCoins(tx.GetHash())->FromTx(tx, nHeight);
 }
 
 void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCache &inputs, int nHeight)
@@ -1899,6 +2121,15 @@ bool CScriptCheck::operator()() {
     return true;
 }
 
+bool CProofCheck::operator()() {
+    size_t nFailed = 0;
+    if (!CachingVerifyJoinSplits(vJoinSplits, cacheStore, nFailed)) {
+        return ::error("CProofCheck(): %s:%d joinsplit does not verify",
+                       vJoinSplits[nFailed].first->GetHash().ToString(), vJoinSplits[nFailed].second);
+    }
+    return true;
+}
+
 int GetSpendHeight(const CCoinsViewCache& inputs)
 {
     LOCK(cs_main);
@@ -2262,6 +2493,15 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+// Each CProofCheck is already a batch of JoinSplit proofs, sized so that
+// every worker gets one; hand them out one at a time.
+static CCheckQueue<CProofCheck> proofcheckqueue(1);
+
+void ThreadProofCheck() {
+    RenameThread("snowgem-proofch");
+    proofcheckqueue.Thread();
+}
+
 //
 // Called periodically asynchronously; alerts if it smells like
 // we're being fed a bad chain (blocks being generated much
@@ -2344,11 +2584,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
     }
 
-    auto verifier = libsnowgem::ProofVerifier::Strict();
     auto disabledVerifier = libsnowgem::ProofVerifier::Disabled();
 
-    // Check it again to verify JoinSplit proofs, and in case a previous version let a bad block in
-    if (!CheckBlock(block, state, fExpensiveChecks ? verifier : disabledVerifier, !fJustCheck, !fJustCheck))
+    // Check it again in case a previous version let a bad block in. JoinSplit
+    // proofs are verified below, alongside the script checks.
+    if (!CheckBlock(block, state, disabledVerifier, !fJustCheck, !fJustCheck))
         return false;
 
     // verify that the view's current state corresponds to the previous block
@@ -2385,6 +2625,31 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     CBlockUndo blockundo;
 
     CCheckQueueControl<CScriptCheck> control(fExpensiveChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
+    CCheckQueueControl<CProofCheck> proofControl(fExpensiveChecks && nScriptCheckThreads ? &proofcheckqueue : NULL);
+
+    // Spread the JoinSplit proofs of the block over one batch per worker, so
+    // that they are verified while the transactions are connected below.
+    if (fExpensiveChecks) {
+        std::vector<CProofCheck> vProofChecks(std::max(nScriptCheckThreads, 1), CProofCheck(false));
+        unsigned int nJoinSplits = 0;
+        BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+            for (unsigned int js = 0; js < tx.vjoinsplit.size(); js++) {
+                vProofChecks[nJoinSplits++ % vProofChecks.size()].Add(tx, js);
+            }
+        }
+        vProofChecks.erase(std::remove_if(vProofChecks.begin(), vProofChecks.end(),
+                                          [](const CProofCheck& check) { return check.IsEmpty(); }),
+                           vProofChecks.end());
+        if (nScriptCheckThreads) {
+            proofControl.Add(vProofChecks);
+        } else {
+            BOOST_FOREACH(CProofCheck& check, vProofChecks) {
+                if (!check())
+                    return state.DoS(100, error("ConnectBlock(): joinsplit does not verify"),
+                                     REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
+            }
+        }
+    }
 
     int64_t nTimeStart = GetTimeMicros();
     CAmount nFees = 0;
@@ -2450,6 +2715,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             control.Add(vChecks);
         }
 
+
         CTxUndo undoDummy;
         if (i > 0) {
             blockundo.vtxundo.push_back(CTxUndo());
@@ -2487,6 +2753,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     if (!control.Wait())
         return state.DoS(100, false);
+    if (!proofControl.Wait())
+        return state.DoS(100, error("ConnectBlock(): joinsplit does not verify"),
+                         REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
     int64_t nTime2 = GetTimeMicros(); nTimeVerify += nTime2 - nTimeStart;
     LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime2 - nTimeStart), nInputs <= 1 ? 0 : 0.001 * (nTime2 - nTimeStart) / (nInputs-1), nTimeVerify * 0.000001);
 
@@ -2540,6 +2809,117 @@ enum FlushStateMode {
     FLUSH_STATE_ALWAYS
 };
 
+/**
+ * Have the coins database prune the trees of the anchors created more than
+ * nAnchorHistory blocks ago along with the next flush. Anchors that mempool
+ * transactions refer to, the first anchor of every ANCHOR_CHECKPOINT_INTERVAL
+ * blocks and anchors of blocks we don't have the data of are kept.
+ */
+static void PruneAnchors()
+{
+    AssertLockHeld(cs_main);
+    if (nAnchorHistory <= 0 || fPruneMode || !pcoinsdbview)
+        return;
+    int nPruneHeight = chainActive.Height() - nAnchorHistory;
+    int nPrunedHeight = pcoinsdbview->GetAnchorsPrunedHeight();
+    if (nPruneHeight <= nPrunedHeight)
+        return;
+
+    std::set<uint256> setMempoolAnchors;
+    mempool.queryAnchors(setMempoolAnchors);
+
+    CAnchorPruning pruning;
+    pruning.nHeight = nPruneHeight;
+    // Start at the beginning of the interval to find out whether an anchor
+    // is the first one of it
+    int nLastChange = -1;
+    for (int nHeight = nPrunedHeight + 1 - (nPrunedHeight + 1) % ANCHOR_CHECKPOINT_INTERVAL; nHeight <= nPruneHeight; nHeight++) {
+        CBlockIndex* pindex = chainActive[nHeight];
+        if (pindex->hashAnchorEnd == pindex->hashAnchor)
+            continue;
+        bool fCheckpoint = nLastChange < nHeight - nHeight % ANCHOR_CHECKPOINT_INTERVAL;
+        nLastChange = nHeight;
+        if (nHeight <= nPrunedHeight || fCheckpoint)
+            continue;
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA) || setMempoolAnchors.count(pindex->hashAnchorEnd))
+            continue;
+        pruning.vAnchors.push_back(make_pair(pindex->hashAnchorEnd, nHeight));
+    }
+    pcoinsdbview->SetAnchorPruning(pruning);
+}
+
+bool RecomputeAnchorTrees(const CCoinsViewDB& db, const std::vector<std::pair<int, uint256> >& vAnchors,
+                          const boost::function<bool (const uint256&, const ZCIncrementalMerkleTree&)>& fn)
+{
+    if (vAnchors.empty())
+        return true;
+
+    // Only the blocks are looked up under cs_main; they are read and replayed
+    // without it. The pprev, height and anchors of a connected block don't
+    // change, so the walks below needn't hold it either.
+    CBlockIndex* pindexFirst;
+    CBlockIndex* pindexLast;
+    {
+        LOCK(cs_main);
+        pindexFirst = chainActive[vAnchors[0].first];
+        pindexLast = chainActive[vAnchors.back().first];
+    }
+    if (!pindexLast)
+        return error("%s: height %d is beyond the tip", __func__, vAnchors.back().first);
+
+    // Walk back to the closest block that starts from a stored anchor
+    ZCIncrementalMerkleTree tree;
+    CBlockIndex* pindexStart = pindexFirst;
+    while (pindexStart && !db.ReadAnchor(pindexStart->hashAnchor, tree))
+        pindexStart = pindexStart->pprev;
+    if (!pindexStart)
+        return error("%s: no stored anchor below height %d", __func__, vAnchors[0].first);
+
+    // The blocks that added note commitments from there on, and where they are
+    std::vector<std::pair<CBlockIndex*, CDiskBlockPos> > vBlocks;
+    for (CBlockIndex* pindex = pindexLast; pindex != pindexStart->pprev; pindex = pindex->pprev) {
+        if (pindex->hashAnchorEnd != pindex->hashAnchor)
+            vBlocks.push_back(make_pair(pindex, CDiskBlockPos()));
+    }
+    std::reverse(vBlocks.begin(), vBlocks.end());
+    {
+        LOCK(cs_main);
+        for (size_t j = 0; j < vBlocks.size(); j++) {
+            if (!(vBlocks[j].first->nStatus & BLOCK_HAVE_DATA))
+                return error("%s: block %s not available", __func__, vBlocks[j].first->GetBlockHash().ToString());
+            vBlocks[j].second = vBlocks[j].first->GetBlockPos();
+        }
+    }
+
+    // Replay them, handing out each anchor once the tree reaches its height
+    size_t i = 0;
+    for (size_t j = 0; j <= vBlocks.size(); j++) {
+        int nHeight = j < vBlocks.size() ? vBlocks[j].first->nHeight : pindexLast->nHeight + 1;
+        for (; i < vAnchors.size() && vAnchors[i].first < nHeight; i++) {
+            if (tree.root() != vAnchors[i].second)
+                return error("%s: anchor %s isn't the one at height %d", __func__, vAnchors[i].second.ToString(), vAnchors[i].first);
+            if (!fn(vAnchors[i].second, tree))
+                return false;
+        }
+        if (j == vBlocks.size())
+            break;
+
+        boost::this_thread::interruption_point();
+        // Connected blocks have a valid header, so only the hash is checked
+        CBlock block;
+        if (!ReadBlockFromDisk(block, vBlocks[j].second, false) || block.GetHash() != vBlocks[j].first->GetBlockHash())
+            return error("%s: failed to read block %s", __func__, vBlocks[j].first->GetBlockHash().ToString());
+        BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+            BOOST_FOREACH(const JSDescription& joinsplit, tx.vjoinsplit) {
+                BOOST_FOREACH(const uint256& note_commitment, joinsplit.commitments) {
+                    tree.append(note_commitment);
+                }
+            }
+        }
+    }
+    return true;
+}
+
 /**
  * Update the on-disk chain state.
  * The caches and indexes are flushed depending on the mode we're called with
@@ -2565,6 +2945,10 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
             }
         }
     }
+    // The coins cache is written to the database in the background; stop
+    // as soon as that fails, as the chainstate can't be saved anymore.
+    if (pcoinsdbview && pcoinsdbview->HasWriteFailed())
+        return AbortNode(state, "Failed to write to coin database");
     int64_t nNow = GetTimeMicros();
     // Avoid writing/flushing immediately after startup.
     if (nLastWrite == 0) {
@@ -2603,18 +2987,23 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
                 setDirtyFileInfo.erase(it++);
             }
             std::vector<const CBlockIndex*> vBlocks;
+            std::vector<CBlockIndex*> vWritten;
             vBlocks.reserve(setDirtyBlockIndex.size());
+            vWritten.reserve(setDirtyBlockIndex.size());
             for (set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end(); ) {
                 vBlocks.push_back(*it);
+                vWritten.push_back(*it);
                 setDirtyBlockIndex.erase(it++);
             }
             if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
                 return AbortNode(state, "Files to write to block index database");
             }
+            // The Equihash solutions are now in the block tree database; don't
+            // keep a copy of them in memory.
+            BOOST_FOREACH(CBlockIndex* pindex, vWritten) {
+                pindex->TrimSolution();
+            }
         }
-        // Finally remove any pruned files
-        if (fFlushForPrune)
-            UnlinkPrunedFiles(setFilesToPrune);
         nLastWrite = nNow;
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
@@ -2626,9 +3015,24 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         // overwrite one. Still, use a conservative safety factor of 2.
         if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
-        // Flush the chainstate (which may refer to block index entries).
-        if (!pcoinsTip->Flush())
+        // Flush the chainstate (which may refer to block index entries),
+        // along with the statistics about it.
+        if (pcoinsdbview && fUTXOStatsLoaded)
+            pcoinsdbview->SetUTXOStats(utxoStats);
+        PruneAnchors();
+        bool fFlushed = pcoinsTip->Flush();
+        // Coins prefetched before the flush may be outdated now
+        InvalidatePrefetchedCoins();
+        // Block files can only be pruned once the chainstate no longer needs
+        // them to be replayed after a crash, and callers asking for a full
+        // flush (e.g. at shutdown) expect everything to be on disk.
+        if (fFlushed && pcoinsdbview && (fFlushForPrune || mode == FLUSH_STATE_ALWAYS))
+            fFlushed = pcoinsdbview->WaitForWrite();
+        if (!fFlushed)
             return AbortNode(state, "Failed to write to coin database");
+        // Finally remove any pruned files, now that the chainstate is on disk
+        if (fFlushForPrune)
+            UnlinkPrunedFiles(setFilesToPrune);
         nLastFlush = nNow;
     }
     if ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000) {
@@ -2697,6 +3101,8 @@ void static UpdateTip(CBlockIndex *pindexNew) {
 bool static DisconnectTip(CValidationState &state) {
     CBlockIndex *pindexDelete = chainActive.Tip();
     assert(pindexDelete);
+    if (pindexDelete == pindexSnapshot)
+        return error("DisconnectTip(): can't disconnect block %s, the chainstate was loaded from a snapshot at it", pindexDelete->GetBlockHash().ToString());
     mempool.check(pcoinsTip);
     // Read block from disk.
     CBlock block;
@@ -2709,6 +3115,8 @@ bool static DisconnectTip(CValidationState &state) {
         CCoinsViewCache view(pcoinsTip);
         if (!DisconnectBlock(block, state, pindexDelete, view))
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
+        if (fUTXOStatsLoaded)
+            UpdateUTXOStats(utxoStats, block, *pcoinsTip, view, false);
         assert(view.Flush());
     }
     LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
@@ -2762,8 +3170,9 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
     // Read block from disk.
     int64_t nTime1 = GetTimeMicros();
     CBlock block;
+    bool fPrefetched = TakePrefetchedBlock(pindexNew->GetBlockHash(), block, *pcoinsTip);
     if (!pblock) {
-        if (!ReadBlockFromDisk(block, pindexNew))
+        if (!fPrefetched && !ReadBlockFromDisk(block, pindexNew))
             return AbortNode(state, "Failed to read block");
         pblock = &block;
     }
@@ -2775,6 +3184,8 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
     int64_t nTime3;
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
     {
+        uint64_t nCoinsHits, nCoinsMisses;
+        pcoinsTip->GetHitStats(nCoinsHits, nCoinsMisses);
         CCoinsViewCache view(pcoinsTip);
         bool rv = ConnectBlock(*pblock, state, pindexNew, view);
         GetMainSignals().BlockChecked(*pblock, state);
@@ -2786,6 +3197,16 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
         mapBlockSource.erase(pindexNew->GetBlockHash());
         nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
         LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
+        if (fDebug) {
+            uint64_t nHits, nMisses;
+            pcoinsTip->GetHitStats(nHits, nMisses);
+            nHits -= nCoinsHits;
+            nMisses -= nCoinsMisses;
+            LogPrint("bench", "  - Coins cache: %u hits, %u misses (%.1f%% hit ratio)%s\n", nHits, nMisses,
+                     nHits + nMisses ? 100.0 * nHits / (nHits + nMisses) : 100.0, fPrefetched ? ", prefetched" : "");
+        }
+        if (fUTXOStatsLoaded)
+            UpdateUTXOStats(utxoStats, *pblock, *pcoinsTip, view, true);
         assert(view.Flush());
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
@@ -2937,6 +3358,13 @@ static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMo
     }
     nHeight = nTargetHeight;
 
+    // Start reading the blocks following the next one, and the coins they
+    // spend, while the next one is being connected.
+    if (IsInitialBlockDownload()) {
+        for (int i = 1; i <= COINS_PREFETCH_DEPTH && i < (int)vpindexToConnect.size(); i++)
+            PrefetchBlock(vpindexToConnect[vpindexToConnect.size() - 1 - i]);
+    }
+
     // Connect new blocks.
     BOOST_REVERSE_FOREACH(CBlockIndex *pindexConnect, vpindexToConnect) {
         if (!ConnectTip(state, pindexConnect, pindexConnect == pindexMostWork ? pblock : NULL)) {
@@ -2990,7 +3418,7 @@ bool ActivateBestChain(CValidationState &state, CBlock *pblock) {
             pindexMostWork = FindMostWorkChain();
 
             // Whether we have anything to do at all.
-            if (pindexMostWork == NULL || pindexMostWork == chainActive.Tip())
+            if (pindexMostWork == NULL || pindexMostWork == chainActive.Tip() || fLoadingSnapshot)
                 return true;
 
             if (!ActivateBestChainStep(state, pindexMostWork, pblock && pblock->GetHash() == pindexMostWork->GetBlockHash() ? pblock : NULL))
@@ -3405,10 +3833,14 @@ bool CheckBlock(const CBlock& block, CValidationState& state,
                 LogPrintf("CheckBlock(): Masternode payment check skipped on sync - skipping IsBlockPayeeValid()\n");
         }
     }
-    // Check transactions
+    // Check transactions, collecting the joinSplitSigs so that they can be
+    // verified together afterwards
+    std::vector<CJoinSplitSigCheck> vSigChecks;
     BOOST_FOREACH(const CTransaction& tx, block.vtx)
-        if (!CheckTransaction(tx, state, verifier))
+        if (!CheckTransaction(tx, state, verifier, &vSigChecks))
             return error("CheckBlock(): CheckTransaction failed");
+    if (!CheckJoinSplitSigs(vSigChecks, state))
+        return error("CheckBlock(): CheckTransaction failed");
 
     unsigned int nSigOps = 0;
     BOOST_FOREACH(const CTransaction& tx, block.vtx)
@@ -3514,7 +3946,60 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex)
+bool CBlockHeaderCheck::operator()() {
+    const CChainParams& chainparams = Params();
+    if (!CheckEquihashSolution(pheader, chainparams))
+        return ::error("CBlockHeaderCheck(): %s Equihash solution invalid", pheader->GetHash().ToString());
+    if (!CheckProofOfWork(pheader->GetHash(), pheader->nBits, chainparams.GetConsensus()))
+        return ::error("CBlockHeaderCheck(): %s proof of work failed", pheader->GetHash().ToString());
+    return true;
+}
+
+// Headers are checked before taking cs_main, so the queue needs its own lock
+static CCheckQueue<CBlockHeaderCheck> headercheckqueue(16);
+static boost::mutex cs_headercheckqueue;
+
+void ThreadHeaderCheck() {
+    RenameThread("snowgem-hdrch");
+    headercheckqueue.Thread();
+}
+
+bool CheckBlockHeadersPOW(const std::vector<CBlockHeader>& vHeaders)
+{
+    int64_t nTimeStart = GetTimeMicros();
+    std::vector<CBlockHeaderCheck> vChecks;
+    {
+        LOCK(cs_main);
+        BOOST_FOREACH(const CBlockHeader& header, vHeaders) {
+            // AcceptBlockHeader doesn't check known headers again either
+            if (!mapBlockIndex.count(header.GetHash()))
+                vChecks.push_back(CBlockHeaderCheck(header));
+        }
+    }
+    unsigned int nChecks = vChecks.size();
+
+    bool fValid = true;
+    if (nScriptCheckThreads && nChecks > 1) {
+        boost::lock_guard<boost::mutex> lock(cs_headercheckqueue);
+        CCheckQueueControl<CBlockHeaderCheck> control(&headercheckqueue);
+        control.Add(vChecks);
+        fValid = control.Wait();
+    } else {
+        BOOST_FOREACH(CBlockHeaderCheck& check, vChecks) {
+            if (!check()) {
+                fValid = false;
+                break;
+            }
+        }
+    }
+
+    int64_t nTime = GetTimeMicros() - nTimeStart;
+    LogPrint("bench", "    - Check proof of work of %u headers: %.2fms (%.2fms/header)\n",
+             nChecks, 0.001 * nTime, nChecks ? 0.001 * nTime / nChecks : 0);
+    return fValid;
+}
+
+bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex, bool fCheckPOW)
 {
     const CChainParams& chainparams = Params();
     AssertLockHeld(cs_main);
@@ -3532,7 +4017,7 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
         return true;
     }
 
-    if (!CheckBlockHeader(block, state))
+    if (!CheckBlockHeader(block, state, fCheckPOW))
         return false;
 
     // Get prev block index
@@ -3882,6 +4367,21 @@ bool static LoadBlockIndexDB()
 
     boost::this_thread::interruption_point();
 
+    // If the chainstate was loaded from a snapshot, the blocks before the
+    // snapshot block are missing, and the totals for the chain up to it come
+    // from the snapshot.
+    CCoinsSnapshotMetadata snapshot;
+    if (pblocktree->ReadSnapshotBase(snapshot)) {
+        BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
+        for (CBlockIndex* pindex = it != mapBlockIndex.end() ? it->second : NULL; pindex; pindex = pindex->pprev) {
+            if (pindex->GetBlockHash() == snapshot.hashBlock) {
+                pindexSnapshot = pindex;
+                LogPrintf("%s: chainstate was loaded from a snapshot at block %s (height %d)\n", __func__, snapshot.hashBlock.ToString(), pindex->nHeight);
+                break;
+            }
+        }
+    }
+
     // Calculate nChainWork
     vector<pair<int, CBlockIndex*> > vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
@@ -3916,6 +4416,10 @@ bool static LoadBlockIndexDB()
                 pindex->nChainSproutValue = pindex->nSproutValue;
             }
         }
+        if (pindex == pindexSnapshot) {
+            pindex->nChainTx = snapshot.nChainTx;
+            pindex->nChainSproutValue = snapshot.nChainSproutValue;
+        }
         if (pindex->IsValid(BLOCK_VALID_TRANSACTIONS) && (pindex->nChainTx || pindex->pprev == NULL))
             setBlockIndexCandidates.insert(pindex);
         if (pindex->nStatus & BLOCK_FAILED_MASK && (!pindexBestInvalid || pindex->nChainWork > pindexBestInvalid->nChainWork))
@@ -4045,6 +4549,8 @@ bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth
         uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
         if (pindex->nHeight < chainActive.Height()-nCheckDepth)
             break;
+        if (pindexSnapshot && pindex->nHeight <= pindexSnapshot->nHeight)
+            break;
         CBlock block;
         // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex))
@@ -4128,6 +4634,8 @@ void UnloadBlockIndex()
     }
     mapBlockIndex.clear();
     fHavePruned = false;
+    fUTXOStatsLoaded = false;
+    pindexSnapshot = NULL;
 }
 
 bool LoadBlockIndex()
@@ -4182,6 +4690,305 @@ bool InitBlockIndex() {
     return true;
 }
 
+bool LoadUTXOStats()
+{
+    LOCK(cs_main);
+    fUTXOStatsLoaded = false;
+    int64_t nStart = GetTimeMillis();
+    if (pcoinsdbview->ReadUTXOStats(utxoStats) && utxoStats.hashBlock == pcoinsTip->GetBestBlock()) {
+        LogPrintf("Loaded UTXO set statistics at %s\n", utxoStats.hashBlock.ToString());
+    } else {
+        // The statistics are missing or were written by a different version
+        // (or before the coins database was rebuilt). Scan the database,
+        // which must then have everything pcoinsTip has.
+        LogPrintf("Computing UTXO set statistics...\n");
+        FlushStateToDisk();
+        if (!pcoinsdbview->ComputeUTXOStats(utxoStats))
+            return error("%s: failed to compute the UTXO set statistics", __func__);
+        LogPrintf("Computed UTXO set statistics (%u transactions, %u outputs) in %dms\n",
+                  utxoStats.nTransactions, utxoStats.nTransactionOutputs, GetTimeMillis() - nStart);
+    }
+    fUTXOStatsLoaded = true;
+    return true;
+}
+
+bool GetUTXOStats(CUTXOStats& stats)
+{
+    LOCK(cs_main);
+    if (!fUTXOStatsLoaded)
+        return false;
+    stats = utxoStats;
+    return true;
+}
+
+bool DumpChainstateSnapshot(CValidationState& state, CAutoFile& file, CCoinsSnapshotMetadata& metadata, CCoinsSnapshotCounts& counts)
+{
+    {
+        LOCK(cs_main);
+        if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
+            return false;
+        if (fLoadingSnapshot)
+            return state.Error("A chainstate snapshot is being loaded");
+        CBlockIndex* pindex = chainActive.Tip();
+        CUTXOStats stats;
+        if (!GetUTXOStats(stats) || stats.hashBlock != pindex->GetBlockHash())
+            return state.Error("UTXO set statistics not available");
+        metadata.hashBlock = pindex->GetBlockHash();
+        metadata.nHeight = pindex->nHeight;
+        metadata.nChainTx = pindex->nChainTx;
+        metadata.nChainSproutValue = pindex->nChainSproutValue;
+        metadata.hashUTXOSet = stats.muhash.Finalize();
+    }
+    // The coins database is read as it is once DumpSnapshot starts, so it
+    // doesn't matter if blocks are connected meanwhile, unless the chainstate
+    // is flushed before that.
+    if (!pcoinsdbview->DumpSnapshot(file, metadata, counts))
+        return state.Error("Failed to write the snapshot (the chainstate may have been flushed meanwhile, try again)");
+    return true;
+}
+
+bool LoadChainstateSnapshot(CValidationState& state, CAutoFile& file, const uint256* phashExpected, CCoinsSnapshotMetadata& metadata, CCoinsSnapshotCounts& counts)
+{
+    CHashVerifier<CAutoFile> verifier(&file);
+    try {
+        verifier >> metadata;
+    } catch (const std::exception& e) {
+        return state.Error(strprintf("Invalid snapshot file: %s", e.what()));
+    }
+    if (phashExpected && metadata.hashUTXOSet != *phashExpected)
+        return state.Error(strprintf("Snapshot UTXO set hash %s doesn't match", metadata.hashUTXOSet.ToString()));
+
+    CBlockIndex* pindex;
+    {
+        LOCK(cs_main);
+        if (chainActive.Height() != 0 || pindexSnapshot || fLoadingSnapshot)
+            return state.Error("The chainstate must only have the genesis block connected");
+        BlockMap::iterator mi = mapBlockIndex.find(metadata.hashBlock);
+        if (mi == mapBlockIndex.end())
+            return state.Error(strprintf("Unknown snapshot block %s, wait for the block headers to be downloaded", metadata.hashBlock.ToString()));
+        pindex = mi->second;
+        if (pindex->nHeight != metadata.nHeight || pindex->nStatus & BLOCK_FAILED_MASK ||
+            !pindexBestHeader || pindexBestHeader->GetAncestor(pindex->nHeight) != pindex)
+            return state.Error(strprintf("Snapshot block %s is not in the best header chain", metadata.hashBlock.ToString()));
+        if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
+            return false;
+        // Keep the chainstate at the genesis block while the coins database
+        // is filled in without cs_main.
+        fLoadingSnapshot = true;
+    }
+
+    LogPrintf("Loading chainstate snapshot at block %s (height %d)...\n", metadata.hashBlock.ToString(), metadata.nHeight);
+    int64_t nStart = GetTimeMillis();
+    CUTXOStats stats;
+    std::string strError;
+    bool fLoaded;
+    try {
+        fLoaded = pcoinsdbview->LoadSnapshot(verifier, stats, counts);
+    } catch (const boost::thread_interrupted&) {
+        // The partially loaded entries are discarded at the next startup
+        LOCK(cs_main);
+        fLoadingSnapshot = false;
+        throw;
+    }
+    if (!fLoaded) {
+        strError = "Invalid snapshot file (see debug.log)";
+    } else {
+        uint256 hashChecksum;
+        try {
+            file >> hashChecksum;
+        } catch (const std::exception&) {
+            // Truncated file, reported as a checksum mismatch
+        }
+        if (hashChecksum != verifier.GetHash())
+            strError = "Snapshot file checksum mismatch";
+        else if (stats.muhash.Finalize() != metadata.hashUTXOSet)
+            strError = "Snapshot UTXO set hash mismatch";
+    }
+    stats.hashBlock = metadata.hashBlock;
+
+    LOCK(cs_main);
+    fLoadingSnapshot = false;
+
+    // Record the snapshot block first: it is only used at startup if the
+    // coins database made it there.
+    if (strError.empty() && !pblocktree->WriteSnapshotBase(metadata))
+        return AbortNode(state, "Failed to write to block index database");
+    if (!pcoinsdbview->FinishSnapshot(metadata, stats, strError.empty()))
+        return AbortNode(state, "Failed to write to coin database");
+    if (!strError.empty())
+        return state.Error(strError);
+
+    pcoinsTip->ResetBestBlock();
+    InvalidatePrefetchedCoins();
+    mempool.clear();
+
+    pindex->nChainTx = metadata.nChainTx;
+    pindex->nChainSproutValue = metadata.nChainSproutValue;
+    pindex->hashAnchorEnd = metadata.hashAnchor;
+    pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
+    setDirtyBlockIndex.insert(pindex);
+    setBlockIndexCandidates.insert(pindex);
+    pindexSnapshot = pindex;
+    UpdateTip(pindex);
+    PruneBlockIndexCandidates();
+
+    // The blocks before the snapshot block can't be served to peers
+    nLocalServices &= ~NODE_NETWORK;
+
+    if (!LoadUTXOStats())
+        return state.Error("Failed to load the UTXO set statistics");
+    // This also empties pcoinsTip, which may have cached entries read while
+    // the snapshot was being loaded.
+    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
+        return false;
+    LogPrintf("Loaded chainstate snapshot (%u transactions, %u nullifiers, %u anchors) in %dms\n",
+              counts.nCoins, counts.nNullifiers, counts.nAnchors, GetTimeMillis() - nStart);
+    return true;
+}
+
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+
+bool DumpMempool()
+{
+    int64_t nStart = GetTimeMillis();
+
+    std::vector<std::pair<CTransaction, int64_t> > vtx;
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    {
+        LOCK(mempool.cs);
+        mapDeltas = mempool.mapDeltas;
+        vtx.reserve(mempool.mapTx.size());
+
+        // Oldest first, but parents always before their children, so that
+        // LoadMempool can add them back in order
+        std::set<const CTxMemPoolEntry*> setWritten;
+        typedef CTxMemPool::indexed_transaction_set::index<entry_time>::type::const_iterator timeiter;
+        for (timeiter it = mempool.mapTx.get<entry_time>().begin(); it != mempool.mapTx.get<entry_time>().end(); ++it) {
+            std::vector<const CTxMemPoolEntry*> vStack(1, &*it);
+            while (!vStack.empty()) {
+                const CTxMemPoolEntry* pentry = vStack.back();
+                if (setWritten.count(pentry)) {
+                    vStack.pop_back();
+                    continue;
+                }
+                bool fReady = true;
+                BOOST_FOREACH(const CTxMemPoolEntry* pparent, pentry->GetMemPoolParents()) {
+                    if (!setWritten.count(pparent)) {
+                        vStack.push_back(pparent);
+                        fReady = false;
+                    }
+                }
+                if (fReady) {
+                    vtx.push_back(std::make_pair(pentry->GetTx(), pentry->GetTime()));
+                    setWritten.insert(pentry);
+                    vStack.pop_back();
+                }
+            }
+        }
+    }
+
+    int64_t nMid = GetTimeMillis();
+
+    try {
+        boost::filesystem::path pathTmp = GetDataDir() / "mempool.dat.new";
+        CAutoFile file(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull())
+            return error("%s: failed to open %s", __func__, pathTmp.string());
+
+        file << MEMPOOL_DUMP_VERSION;
+        file << vtx;
+        file << mapDeltas;
+        FileCommit(file.Get());
+        file.fclose();
+        RenameOver(pathTmp, GetDataDir() / "mempool.dat");
+    } catch (const std::exception& e) {
+        return error("%s: failed to write mempool: %s", __func__, e.what());
+    }
+
+    int64_t nLast = GetTimeMillis();
+    LogPrintf("Dumped %u mempool transactions to disk: %dms to copy, %dms to dump\n", vtx.size(), nMid - nStart, nLast - nMid);
+    return true;
+}
+
+bool LoadMempool()
+{
+    boost::filesystem::path path = GetDataDir() / "mempool.dat";
+    CAutoFile file(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    int64_t nStart = GetTimeMillis();
+    std::vector<std::pair<CTransaction, int64_t> > vtx;
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    try {
+        uint64_t nVersion;
+        file >> nVersion;
+        if (nVersion != MEMPOOL_DUMP_VERSION)
+            return error("%s: unknown mempool file version %d", __func__, nVersion);
+        file >> vtx;
+        file >> mapDeltas;
+    } catch (const std::exception& e) {
+        return error("%s: failed to deserialize mempool data on disk: %s", __func__, e.what());
+    }
+    file.fclose();
+
+    int64_t nNow = GetTime();
+    int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+
+    // Verify the JoinSplit proofs up front, spread over as many threads as
+    // blocks are verified with, and without holding cs_main. The proof cache
+    // then spares AcceptToMemoryPool from verifying them one by one.
+    std::vector<CProofCheck> vProofChecks(std::max(nScriptCheckThreads, 1), CProofCheck(true));
+    unsigned int nJoinSplits = 0;
+    for (size_t i = 0; i < vtx.size(); i++) {
+        if (vtx[i].second + nExpiryTimeout <= nNow)
+            continue;
+        for (unsigned int js = 0; js < vtx[i].first.vjoinsplit.size(); js++)
+            vProofChecks[nJoinSplits++ % vProofChecks.size()].Add(vtx[i].first, js);
+    }
+    if (nJoinSplits > 0) {
+        boost::thread_group threads;
+        BOOST_FOREACH(CProofCheck& check, vProofChecks) {
+            if (!check.IsEmpty())
+                threads.create_thread(boost::bind(&CProofCheck::operator(), &check));
+        }
+        // The workers use vProofChecks and vtx, so they must be joined even
+        // when Shutdown interrupts this thread.
+        boost::this_thread::disable_interruption di;
+        threads.join_all();
+    }
+    if (ShutdownRequested())
+        return false;
+    int64_t nVerified = GetTimeMillis();
+
+    for (std::map<uint256, std::pair<double, CAmount> >::const_iterator it = mapDeltas.begin(); it != mapDeltas.end(); ++it)
+        mempool.PrioritiseTransaction(it->first, it->first.ToString(), it->second.first, it->second.second);
+
+    int nAccepted = 0, nFailed = 0, nExpired = 0;
+    for (size_t i = 0; i < vtx.size(); i++) {
+        if (vtx[i].second + nExpiryTimeout <= nNow) {
+            nExpired++;
+            continue;
+        }
+        {
+            LOCK(cs_main);
+            CValidationState state;
+            if (AcceptToMemoryPoolWithTime(mempool, state, vtx[i].first, true, NULL, vtx[i].second))
+                nAccepted++;
+            else
+                nFailed++;
+        }
+        if (ShutdownRequested())
+            return false;
+    }
+
+    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i expired (%u JoinSplits verified in %dms, %dms total)\n",
+              nAccepted, nFailed, nExpired, nJoinSplits, nVerified - nStart, GetTimeMillis() - nStart);
+    return true;
+}
+
 
 
 bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
@@ -4339,6 +5146,14 @@ void static CheckBlockIndex()
         if (pindex->pprev != NULL && pindexFirstNotChainValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexFirstNotChainValid = pindex;
         if (pindex->pprev != NULL && pindexFirstNotScriptsValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_SCRIPTS) pindexFirstNotScriptsValid = pindex;
 
+        // A node loaded from a snapshot never received the blocks up to the
+        // snapshot block. For the snapshot block and its descendants, those
+        // ancestors count as if they had all the properties tracked above.
+        const bool fFromSnapshot = pindexSnapshot && pindex->GetAncestor(pindexSnapshot->nHeight) == pindexSnapshot;
+        auto first = [&](CBlockIndex* pindexFirst) -> CBlockIndex* {
+            return fFromSnapshot && pindexFirst && pindexFirst->nHeight <= pindexSnapshot->nHeight ? NULL : pindexFirst;
+        };
+
         // Begin: actual consistency checks.
         if (pindex->pprev == NULL) {
             // Genesis block checks.
@@ -4351,34 +5166,35 @@ void static CheckBlockIndex()
         if (!fHavePruned) {
             // If we've never pruned, then HAVE_DATA should be equivalent to nTx > 0
             assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
-            assert(pindexFirstMissing == pindexFirstNeverProcessed);
+            assert(first(pindexFirstMissing) == first(pindexFirstNeverProcessed));
         } else {
             // If we have pruned, then we can only say that HAVE_DATA implies nTx > 0
             if (pindex->nStatus & BLOCK_HAVE_DATA) assert(pindex->nTx > 0);
         }
         if (pindex->nStatus & BLOCK_HAVE_UNDO) assert(pindex->nStatus & BLOCK_HAVE_DATA);
-        assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0)); // This is pruning-independent.
+        // This is pruning-independent. The transactions of the snapshot block come with the snapshot.
+        if (pindex != pindexSnapshot) assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0));
         // All parents having had data (at some point) is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to nChainTx being set.
-        assert((pindexFirstNeverProcessed != NULL) == (pindex->nChainTx == 0)); // nChainTx != 0 is used to signal that all parent blocks have been processed (but may have been pruned).
-        assert((pindexFirstNotTransactionsValid != NULL) == (pindex->nChainTx == 0));
+        assert((first(pindexFirstNeverProcessed) != NULL) == (pindex->nChainTx == 0)); // nChainTx != 0 is used to signal that all parent blocks have been processed (but may have been pruned).
+        assert((first(pindexFirstNotTransactionsValid) != NULL) == (pindex->nChainTx == 0));
         assert(pindex->nHeight == nHeight); // nHeight must be consistent.
         assert(pindex->pprev == NULL || pindex->nChainWork >= pindex->pprev->nChainWork); // For every block except the genesis block, the chainwork must be larger than the parent's.
         assert(nHeight < 2 || (pindex->pskip && (pindex->pskip->nHeight < nHeight))); // The pskip pointer must point back for all but the first 2 blocks.
         assert(pindexFirstNotTreeValid == NULL); // All mapBlockIndex entries must at least be TREE valid
         if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TREE) assert(pindexFirstNotTreeValid == NULL); // TREE valid implies all parents are TREE valid
-        if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_CHAIN) assert(pindexFirstNotChainValid == NULL); // CHAIN valid implies all parents are CHAIN valid
-        if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_SCRIPTS) assert(pindexFirstNotScriptsValid == NULL); // SCRIPTS valid implies all parents are SCRIPTS valid
+        if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_CHAIN) assert(first(pindexFirstNotChainValid) == NULL); // CHAIN valid implies all parents are CHAIN valid
+        if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_SCRIPTS) assert(first(pindexFirstNotScriptsValid) == NULL); // SCRIPTS valid implies all parents are SCRIPTS valid
         if (pindexFirstInvalid == NULL) {
             // Checks for not-invalid blocks.
             assert((pindex->nStatus & BLOCK_FAILED_MASK) == 0); // The failed mask cannot be set for blocks without invalid parents.
         }
-        if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && pindexFirstNeverProcessed == NULL) {
+        if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && first(pindexFirstNeverProcessed) == NULL) {
             if (pindexFirstInvalid == NULL) {
                 // If this block sorts at least as good as the current tip and
                 // is valid and we have all data for its parents, it must be in
                 // setBlockIndexCandidates.  chainActive.Tip() must also be there
                 // even if some data has been pruned.
-                if (pindexFirstMissing == NULL || pindex == chainActive.Tip()) {
+                if (first(pindexFirstMissing) == NULL || pindex == chainActive.Tip()) {
                     assert(setBlockIndexCandidates.count(pindex));
                 }
                 // If some parent is missing, then it could be that this block was in
@@ -4399,13 +5215,13 @@ void static CheckBlockIndex()
             }
             rangeUnlinked.first++;
         }
-        if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed != NULL && pindexFirstInvalid == NULL) {
+        if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && first(pindexFirstNeverProcessed) != NULL && pindexFirstInvalid == NULL) {
             // If this block has block data available, some parent was never received, and has no invalid parents, it must be in mapBlocksUnlinked.
             assert(foundInUnlinked);
         }
         if (!(pindex->nStatus & BLOCK_HAVE_DATA)) assert(!foundInUnlinked); // Can't be in mapBlocksUnlinked if we don't HAVE_DATA
-        if (pindexFirstMissing == NULL) assert(!foundInUnlinked); // We aren't missing data for any parent -- cannot be in mapBlocksUnlinked.
-        if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed == NULL && pindexFirstMissing != NULL) {
+        if (first(pindexFirstMissing) == NULL) assert(!foundInUnlinked); // We aren't missing data for any parent -- cannot be in mapBlocksUnlinked.
+        if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && first(pindexFirstNeverProcessed) == NULL && first(pindexFirstMissing) != NULL) {
             // We HAVE_DATA for this block, have received data for all parents at some point, but we're currently missing data for some parent.
             assert(fHavePruned); // We must have pruned.
             // This block may have entered mapBlocksUnlinked if:
@@ -5303,15 +6119,25 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         CInv inv(MSG_TX, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
+        // Verify the JoinSplits of new transactions before taking cs_main for
+        // the rest, so that they don't hold up block processing. An invalid
+        // transaction is rejected below as if AcceptToMemoryPool had failed.
+        bool fAlreadyHave;
+        {
+            LOCK(cs_main);
+            fAlreadyHave = AlreadyHave(inv);
+        }
+        CValidationState state;
+        bool fPreChecked = fAlreadyHave || PreCheckTransaction(tx, state);
+
         LOCK(cs_main);
 
         bool fMissingInputs = false;
-        CValidationState state;
 
         pfrom->setAskFor.erase(inv.hash);
         mapAlreadyAskedFor.erase(inv);
 
-        if (!AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs, false, ignoreFees))
+        if (fPreChecked && !AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs, false, ignoreFees))
         {
             mempool.check(pcoinsTip);
             RelayTransaction(tx);
@@ -5443,6 +6269,12 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // The solutions are the bulk of the work; check them all at once,
+        // in parallel, before taking cs_main for linking the headers.
+        // If any fails, AcceptBlockHeader checks them one by one to find
+        // the culprit.
+        bool fPOWChecked = CheckBlockHeadersPOW(headers);
+
         LOCK(cs_main);
 
         if (nCount == 0) {
@@ -5457,7 +6289,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 Misbehaving(pfrom->GetId(), 20);
                 return error("non-continuous headers sequence");
             }
-            if (!AcceptBlockHeader(header, state, &pindexLast)) {
+            if (!AcceptBlockHeader(header, state, &pindexLast, !fPOWChecked)) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
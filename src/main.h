@@ -35,13 +35,21 @@
 #include <utility>
 #include <vector>
 
+#include <boost/function.hpp>
 #include <boost/unordered_map.hpp>
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CCoinsViewDB;
 class CSporkDB;
+struct CCoinsSnapshotCounts;
+struct CCoinsSnapshotMetadata;
+struct CUTXOStats;
 class CBloomFilter;
 class CInv;
+class CBlockHeaderCheck;
+class CJoinSplitSigCheck;
+class CProofCheck;
 class CScriptCheck;
 class CValidationInterface;
 class CValidationState;
@@ -63,6 +71,20 @@ static const unsigned int MAX_P2SH_SIGOPS = 15;
 static const unsigned int MAX_STANDARD_TX_SIGOPS = MAX_BLOCK_SIGOPS/5;
 /** Default for -minrelaytxfee, minimum relay fee for transactions */
 static const unsigned int DEFAULT_MIN_RELAY_TX_FEE = 100;
+/** Default for -maxmempool, maximum megabytes of memory the mempool may use */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -mempoolexpiry, hours after which transactions are dropped from the mempool */
+static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Default for -limitancestorcount, max number of in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_LIMIT = 25;
+/** Default for -limitancestorsize, maximum kilobytes of tx + all in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 101;
+/** Default for -limitdescendantcount, max number of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
+/** Default for -limitdescendantsize, maximum kilobytes of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
+/** Default for -persistmempool */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
 /** The maximum size of a blk?????.dat file (since 0.8) */
@@ -93,6 +115,12 @@ static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 static const unsigned int DATABASE_FLUSH_INTERVAL = 24 * 60 * 60;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
+/** -anchorhistory default (0 = keep the note commitment trees of all anchors) */
+static const int DEFAULT_ANCHOR_HISTORY = 0;
+/** Minimum -anchorhistory, deeper than any reorg we expect */
+static const int MIN_ANCHOR_HISTORY = 1000;
+/** The tree of the first anchor in every so many blocks is never pruned, to recompute the others from */
+static const int ANCHOR_CHECKPOINT_INTERVAL = 1000;
 
 // Sanity check the magic numbers when we change them
 BOOST_STATIC_ASSERT(DEFAULT_BLOCK_MAX_SIZE <= MAX_BLOCK_SIZE);
@@ -133,6 +161,8 @@ extern bool fLargeWorkInvalidChainFound;
 // it is unneeded for testing
 extern bool fCoinbaseEnforcedProtectionEnabled;
 extern size_t nCoinCacheUsage;
+/** Number of recent blocks whose anchors keep their note commitment tree in the coins database (0 = all) */
+extern int nAnchorHistory;
 extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
 extern std::map<uint256, int64_t> mapRejectedBlocks;
@@ -197,6 +227,28 @@ bool InitBlockIndex();
 bool LoadBlockIndex();
 /** Unload database information */
 void UnloadBlockIndex();
+/** Load the UTXO set statistics, or compute them if they don't match the coins database */
+bool LoadUTXOStats();
+/** Get the statistics about the UTXO set at the tip. Returns false if they haven't been loaded yet. */
+bool GetUTXOStats(CUTXOStats& stats);
+/** Write a snapshot of the chainstate at the tip to file (see dumptxoutset) */
+bool DumpChainstateSnapshot(CValidationState& state, CAutoFile& file, CCoinsSnapshotMetadata& metadata, CCoinsSnapshotCounts& counts);
+/**
+ * Replace the chainstate, which must only have the genesis block connected,
+ * by the snapshot in file, and make its block the tip. If phashExpected is
+ * set, the UTXO set hash of the snapshot must match it. cs_main is not held
+ * while the file is read; no blocks are connected meanwhile.
+ */
+bool LoadChainstateSnapshot(CValidationState& state, CAutoFile& file, const uint256* phashExpected, CCoinsSnapshotMetadata& metadata, CCoinsSnapshotCounts& counts);
+/**
+ * Recompute the trees of anchors whose tree was pruned from db, by replaying
+ * the note commitments of the blocks since the closest anchor still stored.
+ * vAnchors holds the height of the block that created each anchor, in
+ * ascending order, and fn is called with each root and tree in that order.
+ * cs_main is only held to look the blocks up, not while they are replayed.
+ */
+bool RecomputeAnchorTrees(const CCoinsViewDB& db, const std::vector<std::pair<int, uint256> >& vAnchors,
+                          const boost::function<bool (const uint256&, const ZCIncrementalMerkleTree&)>& fn);
 /** Process protocol messages received from a given node */
 bool ProcessMessages(CNode* pfrom);
 /**
@@ -208,6 +260,14 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the JoinSplit proof checking thread */
+void ThreadProofCheck();
+/** Run an instance of the joinSplitSig checking thread */
+void ThreadJoinSplitSigCheck();
+/** Run an instance of the thread checking the JoinSplit proofs of loose transactions */
+void ThreadTxProofCheck();
+/** Run an instance of the block header checking thread */
+void ThreadHeaderCheck();
 /** Try to detect Partition (network isolation) attacks against us */
 void PartitionCheck(bool (*initialDownloadCheck)(), CCriticalSection& cs, const CBlockIndex *const &bestHeader, int64_t nPowTargetSpacing);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
@@ -257,8 +317,37 @@ void FlushStateToDisk();
 void PruneAndFlush();
 /** See whether the protocol update is enforced for connected nodes */
 int ActiveProtocol();
+/**
+ * Verify the JoinSplit proofs and joinSplitSig of a transaction, which don't
+ * depend on the chain, on the proof checking threads. Call this before taking
+ * cs_main to accept the transaction, so that AcceptToMemoryPool only does the
+ * contextual checks while holding it.
+ */
+bool PreCheckTransaction(const CTransaction& tx, CValidationState& state);
 /** (try to) add transaction to memory pool **/
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool ignoreFees = false);
+/** (try to) add transaction to memory pool with a specified acceptance time **/
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectInsaneFee = false, bool ignoreFees = false);
+/** Write the transactions of the mempool, their entry times and prioritisation to mempool.dat */
+bool DumpMempool();
+/**
+ * Add the transactions of mempool.dat back to the mempool. Their JoinSplit
+ * proofs are verified in parallel first, without holding cs_main.
+ */
+bool LoadMempool();
+
+struct CMempoolAcceptStats
+{
+    uint64_t nPreChecked;    //!< Transactions checked by PreCheckTransaction
+    int64_t nPreCheckTime;   //!< Time spent in PreCheckTransaction, without cs_main (us)
+    uint64_t nAccepted;      //!< Transactions accepted into the mempool
+    int64_t nLockedTime;     //!< Time spent accepting them while holding cs_main (us)
+
+    CMempoolAcceptStats() : nPreChecked(0), nPreCheckTime(0), nAccepted(0), nLockedTime(0) {}
+};
+
+/** Return how long transactions took to check and accept into the mempool */
+CMempoolAcceptStats GetMempoolAcceptStats();
 
 bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool isDSTX = false);
 
@@ -350,9 +439,22 @@ bool ContextualCheckInputs(const CTransaction& tx, CValidationState &state, cons
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCache &inputs, int nHeight);
 
-/** Context-independent validity checks */
-bool CheckTransaction(const CTransaction& tx, CValidationState& state, libsnowgem::ProofVerifier& verifier);
-bool CheckTransactionWithoutProofVerification(const CTransaction& tx, CValidationState &state);
+/**
+ * Context-independent validity checks
+ * If pvSigChecks is not NULL, the joinSplitSig check is pushed onto it
+ * instead of being performed inline.
+ */
+bool CheckTransaction(const CTransaction& tx, CValidationState& state, libsnowgem::ProofVerifier& verifier,
+                      std::vector<CJoinSplitSigCheck> *pvSigChecks = NULL);
+bool CheckTransactionWithoutProofVerification(const CTransaction& tx, CValidationState &state,
+                                              std::vector<CJoinSplitSigCheck> *pvSigChecks = NULL);
+
+/**
+ * Perform joinSplitSig checks collected by CheckTransaction, on the worker
+ * threads if there are any. If a signature is invalid, the first failing
+ * transaction is identified and its reject reason is set on state.
+ */
+bool CheckJoinSplitSigs(std::vector<CJoinSplitSigCheck>& vSigChecks, CValidationState& state);
 
 /** Check for standard transaction types
  * @return True if all outputs (scriptPubKeys) use only standard transaction forms
@@ -409,10 +511,93 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing the verification of a transaction's joinSplitSig
+ * Note that this stores a reference to the transaction
+ */
+class CJoinSplitSigCheck
+{
+private:
+    const CTransaction *ptx;
+    std::string strRejectReason;
+
+public:
+    CJoinSplitSigCheck(): ptx(0) {}
+    CJoinSplitSigCheck(const CTransaction& txIn): ptx(&txIn) {}
+
+    bool operator()();
+
+    void swap(CJoinSplitSigCheck &check) {
+        std::swap(ptx, check.ptx);
+        strRejectReason.swap(check.strRejectReason);
+    }
+
+    const std::string& GetRejectReason() const { return strRejectReason; }
+};
+
+/**
+ * Closure representing the verification of a batch of JoinSplit proofs
+ * Note that this stores references to the transactions containing the JoinSplits
+ */
+class CProofCheck
+{
+private:
+    std::vector<std::pair<const CTransaction*, unsigned int> > vJoinSplits;
+    bool cacheStore;
+
+public:
+    CProofCheck(): cacheStore(false) {}
+    CProofCheck(bool cacheIn): cacheStore(cacheIn) {}
+
+    void Add(const CTransaction& tx, unsigned int nJoinSplit) {
+        vJoinSplits.push_back(std::make_pair(&tx, nJoinSplit));
+    }
+
+    bool IsEmpty() const { return vJoinSplits.empty(); }
+
+    bool operator()();
+
+    void swap(CProofCheck &check) {
+        vJoinSplits.swap(check.vJoinSplits);
+        std::swap(cacheStore, check.cacheStore);
+    }
+};
+
+/**
+ * Closure representing the context-free proof of work checks of a block
+ * header: its Equihash solution, and its hash against its target.
+ * Note that this stores a reference to the header.
+ */
+class CBlockHeaderCheck
+{
+private:
+    const CBlockHeader *pheader;
+
+public:
+    CBlockHeaderCheck(): pheader(0) {}
+    CBlockHeaderCheck(const CBlockHeader& headerIn): pheader(&headerIn) {}
+
+    bool operator()();
+
+    void swap(CBlockHeaderCheck &check) {
+        std::swap(pheader, check.pheader);
+    }
+};
+
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
+/**
+ * Read a block and check its header. If fCheckSolution is false, the
+ * (expensive) Equihash solution check is skipped and only the proof of work
+ * is checked; this is only safe when the caller knows the header to be valid.
+ */
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, bool fCheckSolution = true);
+/**
+ * Read the block of an index entry. Blocks whose header is already known
+ * to be valid (BLOCK_VALID_TREE or better) skip the Equihash solution check;
+ * the block hash is always compared against the index.
+ */
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
 
 
@@ -451,7 +636,18 @@ bool TestBlockValidity(CValidationState &state, const CBlock& block, CBlockIndex
  * If dbp is non-NULL, the file is known to already reside on disk
  */
 bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex **pindex, bool fRequested, CDiskBlockPos* dbp = NULL);
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex **ppindex= NULL);
+/**
+ * Add a block header to the block index. fCheckPOW can only be false for
+ * headers that passed CheckBlockHeadersPOW.
+ */
+bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex **ppindex= NULL, bool fCheckPOW = true);
+/**
+ * Check the Equihash solutions and proof of work of a batch of headers,
+ * spread over the verification threads, without holding cs_main. Headers
+ * already in the block index are skipped. Returns false if any header
+ * fails, in which case AcceptBlockHeader has to find out which.
+ */
+bool CheckBlockHeadersPOW(const std::vector<CBlockHeader>& vHeaders);
 
 
 
@@ -532,6 +728,12 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** Global variable that points to the coins database backing pcoinsTip (protected by cs_main) */
+extern CCoinsViewDB *pcoinsdbview;
+
+/** The block the chainstate was loaded from a snapshot at, if any. The blocks before it are missing. */
+extern CBlockIndex *pindexSnapshot;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
@@ -40,6 +40,7 @@
 #ifdef ENABLE_MINING
 #include <functional>
 #endif
+#include <limits>
 #include <mutex>
 
 using namespace std;
@@ -49,32 +50,11 @@ using namespace std;
 // BitcoinMiner
 //
 
-//
-// Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
-//
-class COrphan
-{
-public:
-    const CTransaction* ptx;
-    set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
-
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
-    {
-    }
-};
-
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 
 // We want to sort transactions by priority and fee rate, so:
-typedef boost::tuple<double, CFeeRate, const CTransaction*> TxPriority;
+typedef boost::tuple<double, CFeeRate, const CTxMemPoolEntry*> TxPriority;
 class TxPriorityCompare
 {
     bool byFee;
@@ -99,260 +79,447 @@ public:
     }
 };
 
-void UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev)
+//! The ancestor package of a pool entry, less the ancestors already in the block
+struct CModifiedPackage
 {
-    pblock->nTime = std::max(pindexPrev->GetMedianTimePast()+1, GetAdjustedTime());
-}
+    const CTxMemPoolEntry* pentry;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
 
-CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
+    CModifiedPackage(const CTxMemPoolEntry* pentryIn) :
+        pentry(pentryIn), nSizeWithAncestors(pentryIn->GetSizeWithAncestors()), nModFeesWithAncestors(pentryIn->GetModFeesWithAncestors()) {}
+};
+
+//! Highest fee rate first, like the ancestor_score index of the pool
+class CompareModifiedPackage
 {
-    const CChainParams& chainparams = Params();
-    // Create new block
-    std::unique_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
-    if(!pblocktemplate.get())
-        return NULL;
-    CBlock *pblock = &pblocktemplate->block; // pointer for convenience
+public:
+    bool operator()(const CModifiedPackage& a, const CModifiedPackage& b) const
+    {
+        double f1 = (double)a.nModFeesWithAncestors * b.nSizeWithAncestors;
+        double f2 = (double)b.nModFeesWithAncestors * a.nSizeWithAncestors;
+        if (f1 == f2)
+            return b.pentry->GetTx().GetHash() < a.pentry->GetTx().GetHash();
+        return f1 > f2;
+    }
+};
 
-    // -regtest only: allow overriding block.nVersion with
-    // -blockversion=N to test forking scenarios
-    if (Params().MineBlocksOnDemand())
-        pblock->nVersion = GetArg("-blockversion", pblock->nVersion);
+//! Parents have fewer ancestors than their children
+class CompareEntryPtrByAncestorCount
+{
+public:
+    bool operator()(const CTxMemPoolEntry* a, const CTxMemPoolEntry* b) const
+    {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return a->GetTx().GetHash() < b->GetTx().GetHash();
+    }
+};
 
-    // Add dummy coinbase tx as first transaction
-    pblock->vtx.push_back(CTransaction());
-    pblocktemplate->vTxFees.push_back(-1); // updated at end
-    pblocktemplate->vTxSigOps.push_back(-1); // updated at end
+//
+// Unconfirmed transactions in the memory pool often depend on other
+// transactions in the memory pool. When we select transactions from the
+// pool by priority, we might consider transactions that depend on
+// transactions that aren't yet in the block. Those wait until the pool
+// entries linked to them as parents are in. By fee rate, we select whole
+// packages of transactions with their ancestors instead.
+//
+class CTxSelector
+{
+    CBlockTemplate& tmpl;
+    CCoinsViewCache& view;
+    const int nHeight;
+    const int64_t nLockTimeCutoff;
+    const unsigned int nBlockMaxSize;
+    int nLastFewTxs;
 
+public:
+    uint64_t nBlockSize;
+    uint64_t nBlockTx;
+    int nBlockSigOps;
+    CAmount nFees;
+    bool fFinished; //!< Whether the block is too full to bother trying more transactions
+    std::set<const CTxMemPoolEntry*> setInBlock;
+
+    CTxSelector(CBlockTemplate& tmplIn, CCoinsViewCache& viewIn, int nHeightIn, int64_t nLockTimeCutoffIn, unsigned int nBlockMaxSizeIn) :
+        tmpl(tmplIn), view(viewIn), nHeight(nHeightIn), nLockTimeCutoff(nLockTimeCutoffIn), nBlockMaxSize(nBlockMaxSizeIn),
+        nLastFewTxs(0), nBlockSize(1000), nBlockTx(0), nBlockSigOps(100), nFees(0), fFinished(false) {}
+
+    //! Whether all the pool transactions entry spends from are in the block
+    bool IsReady(const CTxMemPoolEntry& entry) const
+    {
+        BOOST_FOREACH(const CTxMemPoolEntry* parent, entry.GetMemPoolParents()) {
+            if (!setInBlock.count(parent))
+                return false;
+        }
+        return true;
+    }
+
+    //! Whether nSize more bytes fit in the block. Gives up once the block is (almost) full.
+    bool Fits(uint64_t nSize)
+    {
+        if (nBlockSize + nSize < nBlockMaxSize)
+            return true;
+        if (nBlockSize > nBlockMaxSize - 100 || nLastFewTxs > 50)
+            fFinished = true;
+        else if (nBlockSize > nBlockMaxSize - 1000)
+            nLastFewTxs++;
+        return false;
+    }
+
+    //! Add the transaction of entry, taken from a previous template, without checking it again
+    void Keep(const CTxMemPoolEntry& entry, CAmount nTxFees, int64_t nTxSigOps)
+    {
+        const CTransaction& tx = entry.GetTx();
+        CValidationState state;
+        UpdateCoins(tx, state, view, nHeight);
+
+        tmpl.block.vtx.push_back(tx);
+        tmpl.vTxFees.push_back(nTxFees);
+        tmpl.vTxSigOps.push_back(nTxSigOps);
+        nBlockSize += entry.GetTxSize();
+        ++nBlockTx;
+        nBlockSigOps += nTxSigOps;
+        nFees += nTxFees;
+        setInBlock.insert(&entry);
+    }
+
+    //! Add the transaction of entry to the block if it fits and is valid there
+    bool Add(const CTxMemPoolEntry& entry)
+    {
+        const CTransaction& tx = entry.GetTx();
+        if (tx.IsCoinBase() || !IsFinalTx(tx, nHeight, nLockTimeCutoff))
+            return false;
+
+        // Size limits
+        unsigned int nTxSize = entry.GetTxSize();
+        if (!Fits(nTxSize))
+            return false;
+
+        // Legacy limits on sigOps:
+        unsigned int nTxSigOps = GetLegacySigOpCount(tx);
+        if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+            return false;
+
+        if (!view.HaveInputs(tx))
+            return false;
+
+        CAmount nTxFees = view.GetValueIn(tx)-tx.GetValueOut();
+
+        nTxSigOps += GetP2SHSigOpCount(tx, view);
+        if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+            return false;
+
+        // Note that flags: we don't want to set mempool/IsStandard()
+        // policy here, but we still have to ensure that the block we
+        // create only contains transactions that are valid in new blocks.
+        CValidationState state;
+        if (!ContextualCheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, Params().GetConsensus()))
+            return false;
+
+        UpdateCoins(tx, state, view, nHeight);
+
+        // Added
+        tmpl.block.vtx.push_back(tx);
+        tmpl.vTxFees.push_back(nTxFees);
+        tmpl.vTxSigOps.push_back(nTxSigOps);
+        nBlockSize += nTxSize;
+        ++nBlockTx;
+        nBlockSigOps += nTxSigOps;
+        nFees += nTxFees;
+        setInBlock.insert(&entry);
+        return true;
+    }
+};
+
+void UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev)
+{
+    pblock->nTime = std::max(pindexPrev->GetMedianTimePast()+1, GetAdjustedTime());
+}
+
+static CCriticalSection cs_templateStats;
+static CBlockTemplateStats templateStats;
+
+static void GetBlockSizeLimits(unsigned int& nBlockMaxSize, unsigned int& nBlockPrioritySize, unsigned int& nBlockMinSize)
+{
     // Largest block you're willing to create:
-    unsigned int nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
+    nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
     // Limit to betweeen 1K and MAX_BLOCK_SIZE-1K for sanity:
     nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE-1000), nBlockMaxSize));
 
     // How much of the block should be dedicated to high-priority transactions,
     // included regardless of the fees they pay
-    unsigned int nBlockPrioritySize = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
+    nBlockPrioritySize = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
     nBlockPrioritySize = std::min(nBlockMaxSize, nBlockPrioritySize);
 
     // Minimum block size you want to create; block will be filled with free transactions
     // until there are no more or the block reaches this size:
-    unsigned int nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
+    nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
     nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
+}
 
-    // Collect memory pool transactions into the block
-    CAmount nFees = 0;
-
-    {
-        LOCK2(cs_main, mempool.cs);
-        CBlockIndex* pindexPrev = chainActive.Tip();
-        const int nHeight = pindexPrev->nHeight + 1;
-        pblock->nTime = GetAdjustedTime();
-        const int64_t nMedianTimePast = pindexPrev->GetMedianTimePast();
-        CCoinsViewCache view(pcoinsTip);
-
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
-        bool fPrintPriority = GetBoolArg("-printpriority", false);
+static int64_t GetLockTimeCutoff(const CBlockHeader& block, const CBlockIndex* pindexPrev)
+{
+    return (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+           ? pindexPrev->GetMedianTimePast()
+           : block.GetBlockTime();
+}
 
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi)
-        {
-            const CTransaction& tx = mi->second.GetTx();
+typedef std::set<CModifiedPackage, CompareModifiedPackage> modifiedpackage_set;
+typedef std::map<const CTxMemPoolEntry*, modifiedpackage_set::iterator> modifiedpackage_map;
 
-            int64_t nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
-                                    ? nMedianTimePast
-                                    : pblock->GetBlockTime();
+/**
+ * Take the transactions just added to the block out of the ancestor
+ * packages of their descendants.
+ */
+static void UpdatePackagesForAdded(const CTxSelector& selector, const std::vector<const CTxMemPoolEntry*>& vAdded,
+                                   modifiedpackage_set& setModified, modifiedpackage_map& mapModified)
+{
+    BOOST_FOREACH(const CTxMemPoolEntry* padded, vAdded) {
+        modifiedpackage_map::iterator mit = mapModified.find(padded);
+        if (mit != mapModified.end()) {
+            setModified.erase(mit->second);
+            mapModified.erase(mit);
+        }
 
-            if (tx.IsCoinBase() || !IsFinalTx(tx, nHeight, nLockTimeCutoff))
+        CTxMemPoolEntry::Links setDescendants;
+        mempool.CalculateDescendants(*padded, setDescendants);
+        BOOST_FOREACH(const CTxMemPoolEntry* pdescendant, setDescendants) {
+            if (selector.setInBlock.count(pdescendant))
                 continue;
-
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
-            {
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash))
-                {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash))
-                    {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan)
-                    {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
-                    continue;
-                }
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
-
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
-
-                int nConf = nHeight - coins->nHeight;
-
-                dPriority += (double)nValueIn * nConf;
+            CModifiedPackage package(pdescendant);
+            mit = mapModified.find(pdescendant);
+            if (mit != mapModified.end()) {
+                package = *mit->second;
+                setModified.erase(mit->second);
             }
-            nTotalIn += tx.GetJoinSplitValueIn();
-
-            if (fMissingInputs) continue;
+            package.nSizeWithAncestors -= padded->GetTxSize();
+            package.nModFeesWithAncestors -= padded->GetModifiedFee();
+            mapModified[pdescendant] = setModified.insert(package).first;
+        }
+    }
+}
 
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
+/**
+ * Fill the block with packages of transactions and their ancestors, by
+ * modified fee rate of the package, highest first. This way a child paying
+ * for its parents gets them mined. The packages are walked in the
+ * ancestor_score order of the pool; those with ancestors already in the
+ * block are re-sorted in setModified with the rate of what is left.
+ */
+static void AddTransactionsByFeeRate(CTxSelector& selector, int nHeight, unsigned int nBlockMinSize)
+{
+    bool fPrintPriority = GetBoolArg("-printpriority", false);
+    modifiedpackage_set setModified;
+    modifiedpackage_map mapModified;
+    std::set<const CTxMemPoolEntry*> setFailed;
+
+    // Transactions added by priority, or kept from the previous template
+    std::vector<const CTxMemPoolEntry*> vInBlock(selector.setInBlock.begin(), selector.setInBlock.end());
+    UpdatePackagesForAdded(selector, vInBlock, setModified, mapModified);
+
+    typedef CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::const_iterator scoreiter;
+    scoreiter mi = mempool.mapTx.get<ancestor_score>().begin();
+    scoreiter miEnd = mempool.mapTx.get<ancestor_score>().end();
+    while ((mi != miEnd || !setModified.empty()) && !selector.fFinished)
+    {
+        // Skip entries that are in the block, failed, or better taken from setModified
+        if (mi != miEnd && (selector.setInBlock.count(&*mi) || setFailed.count(&*mi) || mapModified.count(&*mi))) {
+            ++mi;
+            continue;
+        }
 
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
+        bool fModified = !setModified.empty() && (mi == miEnd || CompareModifiedPackage()(*setModified.begin(), CModifiedPackage(&*mi)));
+        CModifiedPackage package = fModified ? *setModified.begin() : CModifiedPackage(&*mi);
+        if (!fModified)
+            ++mi;
+        const CTxMemPoolEntry& entry = *package.pentry;
+
+        // Skip free packages if we're past the minimum block size:
+        const uint256& hash = entry.GetTx().GetHash();
+        double dPriorityDelta = 0;
+        CAmount nFeeDelta = 0;
+        mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
+        CFeeRate feeRate(package.nModFeesWithAncestors, package.nSizeWithAncestors);
+        bool fSkip = (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (selector.nBlockSize + package.nSizeWithAncestors >= nBlockMinSize);
+        if (fSkip || !selector.Fits(package.nSizeWithAncestors)) {
+            // It comes back to setModified if more of its ancestors are added
+            if (fModified) {
+                setModified.erase(setModified.begin());
+                mapModified.erase(&entry);
+            }
+            setFailed.insert(&entry);
+            continue;
+        }
 
-            CFeeRate feeRate(nTotalIn-tx.GetValueOut(), nTxSize);
+        // Add the ancestors that aren't in the block yet, parents first
+        CTxMemPoolEntry::Links setAncestors;
+        std::string dummy;
+        mempool.CalculateMemPoolAncestors(entry, setAncestors, std::numeric_limits<uint64_t>::max(), std::numeric_limits<uint64_t>::max(),
+                                          std::numeric_limits<uint64_t>::max(), std::numeric_limits<uint64_t>::max(), dummy, false);
+        std::vector<const CTxMemPoolEntry*> vPackage;
+        BOOST_FOREACH(const CTxMemPoolEntry* pancestor, setAncestors) {
+            if (!selector.setInBlock.count(pancestor))
+                vPackage.push_back(pancestor);
+        }
+        vPackage.push_back(&entry);
+        std::sort(vPackage.begin(), vPackage.end(), CompareEntryPtrByAncestorCount());
+
+        std::vector<const CTxMemPoolEntry*> vAdded;
+        BOOST_FOREACH(const CTxMemPoolEntry* pentry, vPackage) {
+            if (!selector.Add(*pentry)) {
+                setFailed.insert(pentry);
+                break;
+            }
+            vAdded.push_back(pentry);
 
-            if (porphan)
+            if (fPrintPriority)
             {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
+                LogPrintf("priority %.1f fee %s package fee %s txid %s\n",
+                    pentry->GetPriority(nHeight), CFeeRate(pentry->GetModifiedFee(), pentry->GetTxSize()).ToString(),
+                    feeRate.ToString(), pentry->GetTx().GetHash().ToString());
             }
-            else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->second.GetTx()));
         }
+        if (vAdded.size() < vPackage.size()) {
+            if (fModified) {
+                setModified.erase(setModified.begin());
+                mapModified.erase(&entry);
+            }
+            setFailed.insert(&entry);
+        }
+        UpdatePackagesForAdded(selector, vAdded, setModified, mapModified);
+    }
+}
 
-        // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-
-        while (!vecPriority.empty())
-        {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
+//! Set the coinbase of tmpl, paying nFees on top of the block reward
+static void CreateCoinbase(CBlockTemplate& tmpl, const CScript& scriptPubKeyIn, int nHeight, CAmount nFees)
+{
+    CMutableTransaction txNew;
+    txNew.vin.resize(1);
+    txNew.vin[0].prevout.SetNull();
+    txNew.vout.resize(1);
+    txNew.vout[0].scriptPubKey = scriptPubKeyIn;
 
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
+    // Masternode and general budget payments
+    FillBlockPayee(txNew, nFees);
 
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
+    // Make payee
+    tmpl.block.payee = txNew.vout[txNew.vout.size() - 1].scriptPubKey;
 
-            // Legacy limits on sigOps:
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
+    txNew.vin[0].scriptSig = CScript() << nHeight << OP_0;
 
-            // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
+    tmpl.block.vtx[0] = txNew;
+    tmpl.vTxFees[0] = -nFees;
+    tmpl.vTxSigOps[0] = GetLegacySigOpCount(tmpl.block.vtx[0]);
+}
 
-            // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority)))
-            {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            }
+CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
+{
+    int64_t nTimeStart = GetTimeMicros();
+    // Create new block
+    std::unique_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
+    if(!pblocktemplate.get())
+        return NULL;
+    CBlock *pblock = &pblocktemplate->block; // pointer for convenience
 
-            if (!view.HaveInputs(tx))
-                continue;
+    // -regtest only: allow overriding block.nVersion with
+    // -blockversion=N to test forking scenarios
+    if (Params().MineBlocksOnDemand())
+        pblock->nVersion = GetArg("-blockversion", pblock->nVersion);
 
-            CAmount nTxFees = view.GetValueIn(tx)-tx.GetValueOut();
+    // Add dummy coinbase tx as first transaction
+    pblock->vtx.push_back(CTransaction());
+    pblocktemplate->vTxFees.push_back(-1); // updated at end
+    pblocktemplate->vTxSigOps.push_back(-1); // updated at end
 
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
+    unsigned int nBlockMaxSize, nBlockPrioritySize, nBlockMinSize;
+    GetBlockSizeLimits(nBlockMaxSize, nBlockPrioritySize, nBlockMinSize);
 
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-            CValidationState state;
-            if (!ContextualCheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, Params().GetConsensus()))
-                continue;
+    // Collect memory pool transactions into the block
+    CAmount nFees = 0;
 
-            UpdateCoins(tx, state, view, nHeight);
+    {
+        LOCK2(cs_main, mempool.cs);
+        CBlockIndex* pindexPrev = chainActive.Tip();
+        const int nHeight = pindexPrev->nHeight + 1;
+        pblock->nTime = GetAdjustedTime();
+        CCoinsViewCache view(pcoinsTip);
+        bool fPrintPriority = GetBoolArg("-printpriority", false);
 
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
+        CTxSelector selector(*pblocktemplate, view, nHeight, GetLockTimeCutoff(*pblock, pindexPrev), nBlockMaxSize);
 
-            if (fPrintPriority)
+        // Fill the first nBlockPrioritySize bytes with the highest priority
+        // transactions. Priority grows with the age of the inputs, so unlike
+        // fee rate it can't be kept sorted in the pool.
+        if (nBlockPrioritySize > 0)
+        {
+            vector<TxPriority> vecPriority;
+            vecPriority.reserve(mempool.mapTx.size());
+            for (CTxMemPool::indexed_transaction_set::const_iterator mi = mempool.mapTx.begin();
+                 mi != mempool.mapTx.end(); ++mi)
             {
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                    dPriority, feeRate.ToString(), tx.GetHash().ToString());
+                double dPriority = mi->GetPriority(nHeight);
+                CAmount nDummy = 0;
+                mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, nDummy);
+                vecPriority.push_back(TxPriority(dPriority, CFeeRate(mi->GetModifiedFee(), mi->GetTxSize()), &*mi));
             }
 
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash))
+            TxPriorityCompare comparer(false);
+            std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+            // Transactions popped before their parents were added
+            map<const CTxMemPoolEntry*, TxPriority> mapWaiting;
+
+            while (!vecPriority.empty() && !selector.fFinished)
             {
-                BOOST_FOREACH(COrphan* porphan, mapDependers[hash])
+                // Take highest priority transaction off the priority queue:
+                TxPriority txPriority = vecPriority.front();
+                const CTxMemPoolEntry& entry = *txPriority.get<2>();
+                std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
+                vecPriority.pop_back();
+
+                // The rest is prioritised by fee once past the priority size
+                // or we run out of high-priority transactions
+                if (selector.nBlockSize + entry.GetTxSize() >= nBlockPrioritySize || !AllowFree(txPriority.get<0>()))
+                    break;
+
+                if (!selector.IsReady(entry)) {
+                    mapWaiting.insert(make_pair(&entry, txPriority));
+                    continue;
+                }
+                if (!selector.Add(entry))
+                    continue;
+
+                if (fPrintPriority)
                 {
-                    if (!porphan->setDependsOn.empty())
+                    LogPrintf("priority %.1f fee %s txid %s\n",
+                        txPriority.get<0>(), txPriority.get<1>().ToString(), entry.GetTx().GetHash().ToString());
+                }
+
+                // Add transactions that depend on this one to the priority queue
+                BOOST_FOREACH(const CTxMemPoolEntry* child, entry.GetMemPoolChildren())
+                {
+                    map<const CTxMemPoolEntry*, TxPriority>::iterator it = mapWaiting.find(child);
+                    if (it != mapWaiting.end() && selector.IsReady(*child))
                     {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty())
-                        {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
+                        vecPriority.push_back(it->second);
+                        std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
+                        mapWaiting.erase(it);
                     }
                 }
             }
         }
 
-        nLastBlockTx = nBlockTx;
-        nLastBlockSize = nBlockSize;
-
-        // Create coinbase tx
-        CMutableTransaction txNew;
-        txNew.vin.resize(1);
-        txNew.vin[0].prevout.SetNull();
-        txNew.vout.resize(1);
-        txNew.vout[0].scriptPubKey = scriptPubKeyIn;
+        // Then fill the rest of the block by fee rate
+        AddTransactionsByFeeRate(selector, nHeight, nBlockMinSize);
 
-        // Masternode and general budget payments
-        FillBlockPayee(txNew, nFees);
+        uint64_t nBlockSize = selector.nBlockSize;
+        uint64_t nBlockTx = selector.nBlockTx;
+        nFees = selector.nFees;
 
-        // Make payee
-        pblock->payee = txNew.vout[txNew.vout.size() - 1].scriptPubKey;
-
-        txNew.vin[0].scriptSig = CScript() << nHeight << OP_0;
+        nLastBlockTx = nBlockTx;
+        nLastBlockSize = nBlockSize;
 
-        pblock->vtx[0] = txNew;
-        pblocktemplate->vTxFees[0] = -nFees;
+        CreateCoinbase(*pblocktemplate, scriptPubKeyIn, nHeight, nFees);
 
         // Randomise nonce
         arith_uint256 nonce = UintToArith256(GetRandHash());
@@ -367,16 +534,75 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
         UpdateTime(pblock, Params().GetConsensus(), pindexPrev);
         pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, Params().GetConsensus());
         pblock->nSolution.clear();
-        pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(pblock->vtx[0]);
 
         CValidationState state;
         if (!TestBlockValidity(state, *pblock, pindexPrev, false, false))
             throw std::runtime_error("CreateNewBlock(): TestBlockValidity failed");
     }
 
+    {
+        LOCK(cs_templateStats);
+        templateStats.nBuilds++;
+        templateStats.nLastBuildTime = GetTimeMicros() - nTimeStart;
+    }
     return pblocktemplate.release();
 }
 
+bool UpdateBlockTemplate(CBlockTemplate& tmpl)
+{
+    int64_t nTimeStart = GetTimeMicros();
+    LOCK2(cs_main, mempool.cs);
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    if (tmpl.block.hashPrevBlock != pindexPrev->GetBlockHash())
+        return false;
+    const int nHeight = pindexPrev->nHeight + 1;
+
+    unsigned int nBlockMaxSize, nBlockPrioritySize, nBlockMinSize;
+    GetBlockSizeLimits(nBlockMaxSize, nBlockPrioritySize, nBlockMinSize);
+
+    CBlockTemplate tmplNew;
+    tmplNew.block = CBlock(tmpl.block.GetBlockHeader());
+    tmplNew.block.vtx.push_back(CTransaction());
+    tmplNew.vTxFees.push_back(-1); // updated at end
+    tmplNew.vTxSigOps.push_back(-1); // updated at end
+    UpdateTime(&tmplNew.block, Params().GetConsensus(), pindexPrev);
+
+    CCoinsViewCache view(pcoinsTip);
+    CTxSelector selector(tmplNew, view, nHeight, GetLockTimeCutoff(tmplNew.block, pindexPrev), nBlockMaxSize);
+
+    // Keep the transactions that are still in the pool, in the same order.
+    // They were valid on this tip when the template was made, and so are
+    // their descendants, which leave the pool with them.
+    for (unsigned int i = 1; i < tmpl.block.vtx.size(); i++) {
+        CTxMemPool::txiter it = mempool.mapTx.find(tmpl.block.vtx[i].GetHash());
+        if (it == mempool.mapTx.end() || !selector.IsReady(*it))
+            continue;
+        selector.Keep(*it, tmpl.vTxFees[i], tmpl.vTxSigOps[i]);
+    }
+
+    // New transactions can only fill the space that's left. Priority
+    // doesn't change until the next block, so the package fee rate decides.
+    AddTransactionsByFeeRate(selector, nHeight, nBlockMinSize);
+
+    nLastBlockTx = selector.nBlockTx;
+    nLastBlockSize = selector.nBlockSize;
+
+    CreateCoinbase(tmplNew, tmpl.block.vtx[0].vout[0].scriptPubKey, nHeight, selector.nFees);
+    tmplNew.block.nBits = GetNextWorkRequired(pindexPrev, &tmplNew.block, Params().GetConsensus());
+    std::swap(tmpl, tmplNew);
+
+    LOCK(cs_templateStats);
+    templateStats.nUpdates++;
+    templateStats.nLastUpdateTime = GetTimeMicros() - nTimeStart;
+    return true;
+}
+
+CBlockTemplateStats GetBlockTemplateStats()
+{
+    LOCK(cs_templateStats);
+    return templateStats;
+}
+
 #ifdef ENABLE_WALLET
 boost::optional<CScript> GetMinerScriptPubKey(CReserveKey& reservekey)
 #else
@@ -486,6 +712,59 @@ static bool ProcessBlockFound(CBlock* pblock)
     return true;
 }
 
+/**
+ * Threads that run the tromp solver on the nonce of a miner thread along
+ * with it, each taking its share of the buckets of every round. The miner
+ * thread is thread 0; the others wait for it between nonces, so that the
+ * buckets of the solver are shared instead of being allocated per thread.
+ */
+class CTrompSolverThreads
+{
+private:
+    equi& eq;
+    boost::thread_group threads;
+    pthread_barrier_t start;
+    bool fStop;
+
+    void Run(u32 id)
+    {
+        RenameThread("snowgem-solver");
+        SetThreadPriority(THREAD_PRIORITY_LOWEST);
+        while (true) {
+            ::barrier(&start);
+            if (fStop)
+                return;
+            solve(&eq, id);
+        }
+    }
+
+public:
+    CTrompSolverThreads(equi& eqIn) : eq(eqIn), fStop(false)
+    {
+        const int err = pthread_barrier_init(&start, NULL, eq.nthreads);
+        assert(!err);
+        for (u32 id = 1; id < eq.nthreads; id++)
+            threads.create_thread(boost::bind(&CTrompSolverThreads::Run, this, id));
+    }
+
+    ~CTrompSolverThreads()
+    {
+        // The miner thread may be unwinding from an interruption
+        boost::this_thread::disable_interruption di;
+        fStop = true;
+        ::barrier(&start);
+        threads.join_all();
+        pthread_barrier_destroy(&start);
+    }
+
+    //! Solve for the state last passed to eq.setstate()
+    void Solve()
+    {
+        ::barrier(&start);
+        solve(&eq, 0);
+    }
+};
+
 #ifdef ENABLE_WALLET
 void static BitcoinMiner(CWallet *pwallet)
 #else
@@ -512,6 +791,17 @@ void static BitcoinMiner()
     assert(solver == "tromp" || solver == "default");
     LogPrint("pow", "Using Equihash solver \"%s\" with n = %u, k = %u\n", solver, n, k);
 
+    // The tromp solver is reused for every nonce
+    std::unique_ptr<equi> eq;
+    std::unique_ptr<CTrompSolverThreads> solverThreads;
+    if (solver == "tromp") {
+        int nSolverThreads = GetArg("-equihashsolverthreads", DEFAULT_EQUIHASH_SOLVER_THREADS);
+        nSolverThreads = std::max(1, std::min(nSolverThreads, MAX_EQUIHASH_SOLVER_THREADS));
+        LogPrint("pow", "Using %d threads per Equihash solver\n", nSolverThreads);
+        eq.reset(new equi(nSolverThreads));
+        solverThreads.reset(new CTrompSolverThreads(*eq));
+    }
+
     std::mutex m_cs;
     bool cancelSolver = false;
     boost::signals2::connection c = uiInterface.NotifyBlockTip.connect(
@@ -645,28 +935,17 @@ void static BitcoinMiner()
 
                 // TODO: factor this out into a function with the same API for each solver.
                 if (solver == "tromp") {
-                    // Create solver and initialize it.
-                    equi eq(1);
-                    eq.setstate(&curr_state);
-
-                    // Intialization done, start algo driver.
-                    eq.digit0(0);
-                    eq.xfull = eq.bfull = eq.hfull = 0;
-                    eq.showbsizes(0);
-                    for (u32 r = 1; r < WK; r++) {
-                        (r&1) ? eq.digitodd(r, 0) : eq.digiteven(r, 0);
-                        eq.xfull = eq.bfull = eq.hfull = 0;
-                        eq.showbsizes(r);
-                    }
-                    eq.digitK(0);
+                    // Initialize the solver and run it on all its threads.
+                    eq->setstate(&curr_state);
+                    solverThreads->Solve();
                     ehSolverRuns.increment();
 
                     // Convert solution indices to byte array (decompress) and pass it to validBlock method.
-                    for (size_t s = 0; s < eq.nsols; s++) {
+                    for (size_t s = 0; s < eq->nsols; s++) {
                         LogPrint("pow", "Checking solution %d\n", s+1);
                         std::vector<eh_index> index_vector(PROOFSIZE);
                         for (size_t i = 0; i < PROOFSIZE; i++) {
-                            index_vector[i] = eq.sols[s][i];
+                            index_vector[i] = eq->sols[s][i];
                         }
                         std::vector<unsigned char> sol_char = GetMinimalFromIndices(index_vector, DIGITBITS);
 
@@ -26,8 +26,28 @@ struct CBlockTemplate
     std::vector<int64_t> vTxSigOps;
 };
 
+struct CBlockTemplateStats
+{
+    uint64_t nBuilds;           //!< Templates made from scratch by CreateNewBlock
+    uint64_t nUpdates;          //!< Templates brought up to date by UpdateBlockTemplate
+    int64_t nLastBuildTime;     //!< Time taken by the last build (us)
+    int64_t nLastUpdateTime;    //!< Time taken by the last update (us)
+
+    CBlockTemplateStats() : nBuilds(0), nUpdates(0), nLastBuildTime(0), nLastUpdateTime(0) {}
+};
+
 /** Generate a new block, without valid proof-of-work */
 CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn);
+/**
+ * Bring a template made by CreateNewBlock up to date with the mempool: drop
+ * the transactions that have left the pool and add new ones by fee rate as
+ * space permits. The transactions kept are not checked again, and the block
+ * doesn't go through TestBlockValidity. Returns false if the tip has changed
+ * since, in which case a new template must be created.
+ */
+bool UpdateBlockTemplate(CBlockTemplate& tmpl);
+/** Return the number of templates made and updated, and how long that last took */
+CBlockTemplateStats GetBlockTemplateStats();
 #ifdef ENABLE_WALLET
 boost::optional<CScript> GetMinerScriptPubKey(CReserveKey& reservekey);
 CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey);
@@ -37,6 +57,11 @@ CBlockTemplate* CreateNewBlockWithKey();
 #endif
 
 #ifdef ENABLE_MINING
+/** Default for -equihashsolverthreads, threads working together on a nonce with the tromp solver */
+static const int DEFAULT_EQUIHASH_SOLVER_THREADS = 1;
+/** Maximum for -equihashsolverthreads */
+static const int MAX_EQUIHASH_SOLVER_THREADS = 64;
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 /** Run the miner threads */
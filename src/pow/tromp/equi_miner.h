@@ -609,37 +609,32 @@ void barrier(pthread_barrier_t *barry) {
   }
 }
 
-void *worker(void *vp) {
-  thread_ctx *tp = (thread_ctx *)vp;
-  equi *eq = tp->eq;
-
-  if (tp->id == 0)
-//    printf("Digit 0\n");
+// run the share of thread id of all rounds; all eq->nthreads threads
+// must call this, after setstate
+void solve(equi *eq, const u32 id) {
+  eq->digit0(id);
   barrier(&eq->barry);
-  eq->digit0(tp->id);
-  barrier(&eq->barry);
-  if (tp->id == 0) {
+  if (id == 0) {
     eq->xfull = eq->bfull = eq->hfull = 0;
     eq->showbsizes(0);
   }
   barrier(&eq->barry);
   for (u32 r = 1; r < WK; r++) {
-    if (tp->id == 0)
-//      printf("Digit %d", r);
-    barrier(&eq->barry);
-    r&1 ? eq->digitodd(r, tp->id) : eq->digiteven(r, tp->id);
+    r&1 ? eq->digitodd(r, id) : eq->digiteven(r, id);
     barrier(&eq->barry);
-    if (tp->id == 0) {
-//      printf(" x%d b%d h%d\n", eq->xfull, eq->bfull, eq->hfull);
+    if (id == 0) {
       eq->xfull = eq->bfull = eq->hfull = 0;
       eq->showbsizes(r);
     }
     barrier(&eq->barry);
   }
-  if (tp->id == 0)
-//    printf("Digit %d\n", WK);
-  eq->digitK(tp->id);
+  eq->digitK(id);
   barrier(&eq->barry);
+}
+
+void *worker(void *vp) {
+  thread_ctx *tp = (thread_ctx *)vp;
+  solve(tp->eq, tp->id);
   pthread_exit(NULL);
   return 0;
 }
@@ -10,8 +10,76 @@
 #include "utilstrencodings.h"
 #include "crypto/common.h"
 
+/**
+ * Fast non-cryptographic digest, only used to tell whether the fields of a
+ * header were modified locally since its hash was cached.
+ */
+class CHeaderFieldsDigest
+{
+private:
+    uint64_t h;
+
+    void Mix(uint64_t w)
+    {
+        h ^= w;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 31;
+    }
+
+public:
+    CHeaderFieldsDigest() : h(0x9e3779b97f4a7c15ULL) {}
+
+    CHeaderFieldsDigest& Write(uint64_t w)
+    {
+        Mix(w);
+        return *this;
+    }
+
+    CHeaderFieldsDigest& Write(const unsigned char* p, size_t n)
+    {
+        size_t nLen = n;
+        for (; n >= 8; p += 8, n -= 8)
+            Mix(ReadLE64(p));
+        uint64_t tail = 0;
+        for (size_t i = 0; i < n; i++)
+            tail |= (uint64_t)p[i] << (8 * i);
+        Mix(tail);
+        Mix(nLen);
+        return *this;
+    }
+
+    uint64_t Finalize() const
+    {
+        return h;
+    }
+};
+
+uint64_t CBlockHeader::GetFieldsDigest() const
+{
+    return CHeaderFieldsDigest()
+        .Write((uint64_t)(uint32_t)nVersion)
+        .Write(hashPrevBlock.begin(), hashPrevBlock.size())
+        .Write(hashMerkleRoot.begin(), hashMerkleRoot.size())
+        .Write(hashReserved.begin(), hashReserved.size())
+        .Write(((uint64_t)nBits << 32) | nTime)
+        .Write(nNonce.begin(), nNonce.size())
+        .Write(nSolution.data(), nSolution.size())
+        .Finalize();
+}
+
+void CBlockHeader::CacheHash()
+{
+    hashCached = SerializeHash(*this);
+    nCachedFieldsDigest = GetFieldsDigest();
+    fHashCached = true;
+}
+
 uint256 CBlockHeader::GetHash() const
 {
+    // Digesting the fields is much cheaper than serializing and
+    // double-SHA256ing the header (including its solution) again.
+    if (fHashCached && GetFieldsDigest() == nCachedFieldsDigest)
+        return hashCached;
     return SerializeHash(*this);
 }
 
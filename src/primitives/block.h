@@ -32,6 +32,16 @@ public:
     uint256 nNonce;
     std::vector<unsigned char> nSolution;
 
+private:
+    // memory only
+    uint256 hashCached;
+    uint64_t nCachedFieldsDigest;
+    bool fHashCached;
+
+    uint64_t GetFieldsDigest() const;
+    void CacheHash();
+
+public:
     CBlockHeader()
     {
         SetNull();
@@ -50,6 +60,8 @@ public:
         READWRITE(nBits);
         READWRITE(nNonce);
         READWRITE(nSolution);
+        if (ser_action.ForRead())
+            CacheHash();
     }
 
     void SetNull()
@@ -62,6 +74,7 @@ public:
         nBits = 0;
         nNonce = uint256();
         nSolution.clear();
+        fHashCached = false;
     }
 
     bool IsNull() const
@@ -69,6 +82,12 @@ public:
         return (nBits == 0);
     }
 
+    /**
+     * The hash of a deserialized header is computed once and cached, along
+     * with a cheap digest of the fields it was computed from. It is only
+     * reused as long as the fields still have that digest, so headers remain
+     * freely mutable (e.g. by the miner's nonce loop).
+     */
     uint256 GetHash() const;
 
     int64_t GetBlockTime() const
@@ -0,0 +1,165 @@
+// Copyright (c) 2017-2018 The SnowGem developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "proofcache.h"
+
+#include "hash.h"
+#include "init.h"
+#include "random.h"
+#include "util.h"
+
+#include <atomic>
+#include <set>
+
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+
+namespace {
+
+/**
+ * Valid JoinSplit proof cache, to avoid doing expensive zk-SNARK verification
+ * twice for every shielded transaction (once when accepted into memory pool,
+ * and again when accepted into the block chain)
+ */
+class CProofCache
+{
+private:
+    //! Entries are salted hashes of the full statement proven by a JoinSplit
+    std::set<uint256> setValid;
+    boost::shared_mutex cs_proofcache;
+    uint256 nonce;
+
+public:
+    std::atomic<uint64_t> nHits;
+    std::atomic<uint64_t> nMisses;
+
+    CProofCache() : nonce(GetRandHash()), nHits(0), nMisses(0) {}
+
+    /**
+     * The proof is only valid for the primary input it was created for, so
+     * the entry commits to every public input of the JoinSplit: the anchor,
+     * the values, the nullifiers and random seed (from which h_sig is derived
+     * together with joinSplitPubKey), the MACs and the note commitments.
+     */
+    uint256 ComputeEntry(const JSDescription& joinsplit, const uint256& joinSplitPubKey)
+    {
+        CHashWriter ss(SER_GETHASH, 0);
+        ss << nonce << joinsplit.proof << joinSplitPubKey << joinsplit.randomSeed
+           << joinsplit.nullifiers << joinsplit.macs << joinsplit.commitments
+           << joinsplit.vpub_old << joinsplit.vpub_new << joinsplit.anchor;
+        return ss.GetHash();
+    }
+
+    bool Get(const uint256& entry)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_proofcache);
+        return setValid.count(entry) != 0;
+    }
+
+    void Set(const uint256& entry)
+    {
+        int64_t nMaxCacheSize = GetArg("-maxproofcachesize", DEFAULT_MAX_PROOF_CACHE_SIZE);
+        if (nMaxCacheSize <= 0) return;
+
+        boost::unique_lock<boost::shared_mutex> lock(cs_proofcache);
+
+        while (static_cast<int64_t>(setValid.size()) > nMaxCacheSize)
+        {
+            // Evict a random entry, for the same reasons as the signature cache.
+            std::set<uint256>::iterator it = setValid.lower_bound(GetRandHash());
+            if (it == setValid.end())
+                it = setValid.begin();
+            setValid.erase(it);
+        }
+
+        setValid.insert(entry);
+    }
+
+    uint64_t Size()
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_proofcache);
+        return setValid.size();
+    }
+};
+
+CProofCache proofCache;
+
+}
+
+bool CachingVerifyJoinSplit(const JSDescription& joinsplit, const uint256& joinSplitPubKey, bool store)
+{
+    uint256 entry = proofCache.ComputeEntry(joinsplit, joinSplitPubKey);
+    if (proofCache.Get(entry)) {
+        proofCache.nHits++;
+        return true;
+    }
+    proofCache.nMisses++;
+
+    auto verifier = libsnowgem::ProofVerifier::Strict();
+    if (!joinsplit.Verify(*psnowgemParams, verifier, joinSplitPubKey))
+        return false;
+
+    if (store)
+        proofCache.Set(entry);
+    return true;
+}
+
+bool CachingVerifyJoinSplits(const std::vector<JoinSplitRef>& vJoinSplits, bool store, size_t& nFailed)
+{
+    std::vector<size_t> vPending;
+    std::vector<uint256> vEntries;
+    vPending.reserve(vJoinSplits.size());
+    vEntries.reserve(vJoinSplits.size());
+    for (size_t i = 0; i < vJoinSplits.size(); i++) {
+        const CTransaction& tx = *vJoinSplits[i].first;
+        uint256 entry = proofCache.ComputeEntry(tx.vjoinsplit[vJoinSplits[i].second], tx.joinSplitPubKey);
+        if (proofCache.Get(entry)) {
+            proofCache.nHits++;
+        } else {
+            proofCache.nMisses++;
+            vPending.push_back(i);
+            vEntries.push_back(entry);
+        }
+    }
+
+    bool fBatchOk = false;
+    if (vPending.size() > 1) {
+        auto verifier = libsnowgem::ProofVerifier::Batch();
+        fBatchOk = true;
+        BOOST_FOREACH(size_t i, vPending) {
+            const CTransaction& tx = *vJoinSplits[i].first;
+            if (!tx.vjoinsplit[vJoinSplits[i].second].Verify(*psnowgemParams, verifier, tx.joinSplitPubKey)) {
+                fBatchOk = false;
+                break;
+            }
+        }
+        fBatchOk = fBatchOk && verifier.VerifyBatch();
+        if (!fBatchOk)
+            LogPrint("bench", "%s: batch of %u proofs failed, verifying them one by one\n", __func__, vPending.size());
+    }
+
+    for (size_t n = 0; n < vPending.size(); n++) {
+        size_t i = vPending[n];
+        if (!fBatchOk) {
+            const CTransaction& tx = *vJoinSplits[i].first;
+            auto verifier = libsnowgem::ProofVerifier::Strict();
+            if (!tx.vjoinsplit[vJoinSplits[i].second].Verify(*psnowgemParams, verifier, tx.joinSplitPubKey)) {
+                nFailed = i;
+                return false;
+            }
+        }
+        if (store)
+            proofCache.Set(vEntries[n]);
+    }
+    return true;
+}
+
+CProofCacheStats GetProofCacheStats()
+{
+    CProofCacheStats stats;
+    stats.nHits = proofCache.nHits;
+    stats.nMisses = proofCache.nMisses;
+    stats.nEntries = proofCache.Size();
+    return stats;
+}
@@ -0,0 +1,49 @@
+// Copyright (c) 2017-2018 The SnowGem developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_PROOFCACHE_H
+#define BITCOIN_PROOFCACHE_H
+
+#include "primitives/transaction.h"
+#include "uint256.h"
+
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+/** A JoinSplit to verify, as (transaction, index in vjoinsplit) */
+typedef std::pair<const CTransaction*, unsigned int> JoinSplitRef;
+
+/** Default for -maxproofcachesize, the number of verified JoinSplits to remember */
+static const int64_t DEFAULT_MAX_PROOF_CACHE_SIZE = 50000;
+
+struct CProofCacheStats
+{
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nEntries;
+
+    CProofCacheStats() : nHits(0), nMisses(0), nEntries(0) {}
+};
+
+/**
+ * Verify the zk-SNARK proof of a JoinSplit, skipping the verification if the
+ * same JoinSplit has already been verified successfully (typically when the
+ * transaction was accepted into the memory pool). If store is true, a
+ * successful verification is remembered for later calls.
+ */
+bool CachingVerifyJoinSplit(const JSDescription& joinsplit, const uint256& joinSplitPubKey, bool store);
+
+/**
+ * Verify the proofs of several JoinSplits. The proofs not found in the cache
+ * are verified together with a single multi-pairing check, and one by one
+ * only if that batch check fails. Returns false if any proof is invalid, in
+ * which case nFailed is set to the position of the first invalid JoinSplit.
+ */
+bool CachingVerifyJoinSplits(const std::vector<JoinSplitRef>& vJoinSplits, bool store, size_t& nFailed);
+
+/** Return the hit/miss counters and current size of the proof cache */
+CProofCacheStats GetProofCacheStats();
+
+#endif // BITCOIN_PROOFCACHE_H
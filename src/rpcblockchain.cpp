@@ -7,17 +7,26 @@
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
+#include "clientversion.h"
+#include "coinsprefetch.h"
+#include "coinstats.h"
 #include "consensus/validation.h"
 #include "main.h"
+#include "memusage.h"
 #include "primitives/transaction.h"
+#include "proofcache.h"
 #include "rpcserver.h"
+#include "streams.h"
 #include "sync.h"
+#include "txdb.h"
 #include "util.h"
 
 #include <stdint.h>
 
 #include <univalue.h>
 
+#include <boost/filesystem.hpp>
+
 #include <regex>
 
 using namespace std;
@@ -111,7 +120,7 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     result.push_back(Pair("hashreserved", blockindex->hashReserved.GetHex()));
     result.push_back(Pair("time", (int64_t)blockindex->nTime));
     result.push_back(Pair("nonce", blockindex->nNonce.GetHex()));
-    result.push_back(Pair("solution", HexStr(blockindex->nSolution)));
+    result.push_back(Pair("solution", HexStr(blockindex->GetSolution())));
     result.push_back(Pair("bits", strprintf("%08x", blockindex->nBits)));
     result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
     result.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
@@ -228,10 +237,9 @@ UniValue mempoolToJSON(bool fVerbose = false)
     {
         LOCK(mempool.cs);
         UniValue o(UniValue::VOBJ);
-        BOOST_FOREACH(const PAIRTYPE(uint256, CTxMemPoolEntry)& entry, mempool.mapTx)
+        BOOST_FOREACH(const CTxMemPoolEntry& e, mempool.mapTx)
         {
-            const uint256& hash = entry.first;
-            const CTxMemPoolEntry& e = entry.second;
+            const uint256& hash = e.GetTx().GetHash();
             UniValue info(UniValue::VOBJ);
             info.push_back(Pair("size", (int)e.GetTxSize()));
             info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
@@ -239,12 +247,16 @@ UniValue mempoolToJSON(bool fVerbose = false)
             info.push_back(Pair("height", (int)e.GetHeight()));
             info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
             info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
-            const CTransaction& tx = e.GetTx();
+            info.push_back(Pair("descendantcount", e.GetCountWithDescendants()));
+            info.push_back(Pair("descendantsize", e.GetSizeWithDescendants()));
+            info.push_back(Pair("descendantfees", e.GetModFeesWithDescendants()));
+            info.push_back(Pair("ancestorcount", e.GetCountWithAncestors()));
+            info.push_back(Pair("ancestorsize", e.GetSizeWithAncestors()));
+            info.push_back(Pair("ancestorfees", e.GetModFeesWithAncestors()));
             set<string> setDepends;
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            BOOST_FOREACH(const CTxMemPoolEntry* parent, e.GetMemPoolParents())
             {
-                if (mempool.exists(txin.prevout.hash))
-                    setDepends.insert(txin.prevout.hash.ToString());
+                setDepends.insert(parent->GetTx().GetHash().ToString());
             }
 
             UniValue depends(UniValue::VARR);
@@ -293,6 +305,12 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
             "    \"height\" : n,           (numeric) block height when transaction entered pool\n"
             "    \"startingpriority\" : n, (numeric) priority when transaction entered pool\n"
             "    \"currentpriority\" : n,  (numeric) transaction priority now\n"
+            "    \"descendantcount\" : n,  (numeric) number of in-mempool descendant transactions (including this one)\n"
+            "    \"descendantsize\" : n,   (numeric) size of in-mempool descendants (including this one)\n"
+            "    \"descendantfees\" : n,   (numeric) modified fees (see prioritisetransaction) of in-mempool descendants (including this one), in zatoshis\n"
+            "    \"ancestorcount\" : n,    (numeric) number of in-mempool ancestor transactions (including this one)\n"
+            "    \"ancestorsize\" : n,     (numeric) size of in-mempool ancestors (including this one)\n"
+            "    \"ancestorfees\" : n,     (numeric) modified fees (see prioritisetransaction) of in-mempool ancestors (including this one), in zatoshis\n"
             "    \"depends\" : [           (array) unconfirmed transactions used as inputs for this transaction\n"
             "        \"transactionid\",    (string) parent transaction id\n"
             "       ... ]\n"
@@ -488,11 +506,14 @@ UniValue getblock(const UniValue& params, bool fHelp)
 
 UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( \"hash_type\" )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"hash_type\"  (string, optional, default=\"hash_serialized\") Which UTXO set hash to return, \"hash_serialized\" or \"muhash\".\n"
+            "                 hash_serialized is computed by scanning the whole UTXO set, which may take some time, while\n"
+            "                 the statistics and the muhash are kept up to date as blocks are connected.\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
@@ -500,19 +521,49 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
             "  \"transactions\": n,      (numeric) The number of transactions\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
-            "  \"total_amount\": x.xxx          (numeric) The total amount\n"
+            "  \"hash_serialized\": \"hash\",   (string) The serialized hash (if hash_type is \"hash_serialized\")\n"
+            "  \"muhash\": \"hash\",      (string) The rolling hash of the UTXO set (if hash_type is \"muhash\")\n"
+            "  \"total_amount\": x.xxx,         (numeric) The total amount\n"
+            "  \"valuePools\": [              (array) Shielded value pools at the best block\n"
+            "    {\n"
+            "      \"id\": \"sprout\",          (string) The value pool\n"
+            "      \"monitored\": true|false, (boolean) Whether the value of the pool is known\n"
+            "      \"chainValue\": x.xxx,     (numeric) The value of the pool\n"
+            "      \"chainValueZat\": n       (numeric) The value of the pool in zatoshis\n"
+            "    }\n"
+            "  ]\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "\"muhash\"")
             + HelpExampleRpc("gettxoutsetinfo", "")
         );
 
+    std::string strHashType = params.size() > 0 ? params[0].get_str() : "hash_serialized";
+    if (strHashType != "hash_serialized" && strHashType != "muhash")
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid hash_type, expected \"hash_serialized\" or \"muhash\"");
+
     UniValue ret(UniValue::VOBJ);
+    uint256 hashBlock;
 
-    CCoinsStats stats;
-    FlushStateToDisk();
-    if (pcoinsTip->GetStats(stats)) {
+    CUTXOStats utxoStats;
+    if (strHashType == "muhash" && GetUTXOStats(utxoStats)) {
+        hashBlock = utxoStats.hashBlock;
+        LOCK(cs_main);
+        BlockMap::const_iterator mi = mapBlockIndex.find(hashBlock);
+        ret.push_back(Pair("height", mi != mapBlockIndex.end() ? (int64_t)mi->second->nHeight : -1));
+        ret.push_back(Pair("bestblock", hashBlock.GetHex()));
+        ret.push_back(Pair("transactions", (int64_t)utxoStats.nTransactions));
+        ret.push_back(Pair("txouts", (int64_t)utxoStats.nTransactionOutputs));
+        ret.push_back(Pair("bytes_serialized", (int64_t)utxoStats.nSerializedSize));
+        ret.push_back(Pair("muhash", utxoStats.muhash.Finalize().GetHex()));
+        ret.push_back(Pair("total_amount", ValueFromAmount(utxoStats.nTotalAmount)));
+    } else {
+        CCoinsStats stats;
+        FlushStateToDisk();
+        if (!pcoinsTip->GetStats(stats))
+            return ret;
+        hashBlock = stats.hashBlock;
         ret.push_back(Pair("height", (int64_t)stats.nHeight));
         ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
         ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
@@ -521,6 +572,52 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
         ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
         ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
     }
+
+    // The shielded value pools are tracked by the block index
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator mi = mapBlockIndex.find(hashBlock);
+        if (mi != mapBlockIndex.end()) {
+            UniValue valuePools(UniValue::VARR);
+            valuePools.push_back(ValuePoolDesc("sprout", mi->second->nChainSproutValue, boost::none));
+            ret.push_back(Pair("valuePools", valuePools));
+        }
+    }
+    return ret;
+}
+
+UniValue getanchorinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getanchorinfo\n"
+            "\nReturns how much of the coin database the note commitment trees of anchors take up.\n"
+            "With -anchorhistory, the trees of older anchors are pruned and recomputed from blocks when needed.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"anchorhistory\": n,   (numeric) The number of recent blocks whose anchors are kept (0 = all)\n"
+            "  \"prunedheight\": n,    (numeric) The height up to which anchors have been considered for pruning\n"
+            "  \"anchors\": n,         (numeric) The number of anchors with their tree stored\n"
+            "  \"bytes\": n,           (numeric) The size of those entries in the database\n"
+            "  \"pruned\": n,          (numeric) The number of anchors whose tree was pruned\n"
+            "  \"pruned_bytes\": n     (numeric) The size of the entries kept for them\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getanchorinfo", "")
+            + HelpExampleRpc("getanchorinfo", "")
+        );
+
+    CAnchorStats stats;
+    if (!pcoinsdbview->GetAnchorStats(stats))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read the anchors from the coin database");
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("anchorhistory", nAnchorHistory));
+    ret.push_back(Pair("prunedheight", stats.nPrunedHeight));
+    ret.push_back(Pair("anchors", (int64_t)stats.nAnchors));
+    ret.push_back(Pair("bytes", (int64_t)stats.nAnchorBytes));
+    ret.push_back(Pair("pruned", (int64_t)stats.nPruned));
+    ret.push_back(Pair("pruned_bytes", (int64_t)stats.nPrunedBytes));
     return ret;
 }
 
@@ -847,6 +944,14 @@ UniValue mempoolInfoToJSON()
     ret.push_back(Pair("size", (int64_t) mempool.size()));
     ret.push_back(Pair("bytes", (int64_t) mempool.GetTotalTxSize()));
     ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
+    size_t maxmempool = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
+    ret.push_back(Pair("maxmempool", (int64_t) maxmempool));
+    ret.push_back(Pair("mempoolminfee", ValueFromAmount(mempool.GetMinFee(maxmempool).GetFeePerK())));
+    CMempoolAcceptStats stats = GetMempoolAcceptStats();
+    ret.push_back(Pair("prechecked", (int64_t)stats.nPreChecked));
+    ret.push_back(Pair("prechecktime", stats.nPreChecked ? stats.nPreCheckTime * 0.001 / stats.nPreChecked : 0.0));
+    ret.push_back(Pair("accepted", (int64_t)stats.nAccepted));
+    ret.push_back(Pair("acceptlocktime", stats.nAccepted ? stats.nLockedTime * 0.001 / stats.nAccepted : 0.0));
 
     return ret;
 }
@@ -862,6 +967,12 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
             "  \"size\": xxxxx                (numeric) Current tx count\n"
             "  \"bytes\": xxxxx               (numeric) Sum of all tx sizes\n"
             "  \"usage\": xxxxx               (numeric) Total memory usage for the mempool\n"
+            "  \"maxmempool\": xxxxx          (numeric) Maximum memory usage for the mempool (see -maxmempool)\n"
+            "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee rate in " + CURRENCY_UNIT + "/kB for a transaction to be accepted\n"
+            "  \"prechecked\": xxxxx          (numeric) Transactions whose JoinSplits were verified before taking the main lock\n"
+            "  \"prechecktime\": xxxxx        (numeric) Average time spent verifying them, in milliseconds\n"
+            "  \"accepted\": xxxxx            (numeric) Transactions accepted into the mempool\n"
+            "  \"acceptlocktime\": xxxxx      (numeric) Average time the main lock was held to accept one, in milliseconds\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmempoolinfo", "")
@@ -871,6 +982,137 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
     return mempoolInfoToJSON();
 }
 
+UniValue getproofcacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getproofcacheinfo\n"
+            "\nReturns details on the cache of verified JoinSplit proofs.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"entries\": xxxxx             (numeric) Number of verified JoinSplits currently cached\n"
+            "  \"hits\": xxxxx                (numeric) Number of proof verifications skipped thanks to the cache\n"
+            "  \"misses\": xxxxx              (numeric) Number of proofs that had to be verified\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getproofcacheinfo", "")
+            + HelpExampleRpc("getproofcacheinfo", "")
+        );
+
+    CProofCacheStats stats = GetProofCacheStats();
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("entries", (int64_t)stats.nEntries));
+    ret.push_back(Pair("hits", (int64_t)stats.nHits));
+    ret.push_back(Pair("misses", (int64_t)stats.nMisses));
+    return ret;
+}
+
+UniValue getcoinscacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getcoinscacheinfo\n"
+            "\nReturns details on the cache of unspent transaction outputs, on coins prefetching and on writes of the cache to disk.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"entries\": xxxxx             (numeric) Number of transactions with unspent outputs currently cached\n"
+            "  \"usage\": xxxxx               (numeric) Estimated memory usage of the cache, in bytes\n"
+            "  \"hits\": xxxxx                (numeric) Number of lookups served from the cache\n"
+            "  \"misses\": xxxxx              (numeric) Number of lookups that had to read the database\n"
+            "  \"prefetch\": {\n"
+            "    \"blocks\": xxxxx            (numeric) Number of blocks read ahead of time during initial block download\n"
+            "    \"blocksused\": xxxxx        (numeric) Number of those blocks that were then connected\n"
+            "    \"coins\": xxxxx             (numeric) Number of prefetched coins added to the cache\n"
+            "    \"nullifiers\": xxxxx        (numeric) Number of prefetched nullifiers added to the cache\n"
+            "    \"stale\": xxxxx             (numeric) Number of blocks whose prefetched coins were outdated by a flush\n"
+            "  },\n"
+            "  \"flush\": {\n"
+            "    \"writes\": xxxxx            (numeric) Number of times the cache was written to the coins database\n"
+            "    \"pending\": true|false      (boolean) Whether a write is in progress in the background\n"
+            "    \"lastduration\": xxxxx      (numeric) Time taken by the last write, in milliseconds\n"
+            "    \"lastbytes\": xxxxx         (numeric) Approximate number of bytes written by the last write\n"
+            "    \"totalbytes\": xxxxx        (numeric) Approximate number of bytes written in total\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getcoinscacheinfo", "")
+            + HelpExampleRpc("getcoinscacheinfo", "")
+        );
+
+    LOCK(cs_main);
+
+    uint64_t nHits, nMisses;
+    pcoinsTip->GetHitStats(nHits, nMisses);
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("entries", (int64_t)pcoinsTip->GetCacheSize()));
+    ret.push_back(Pair("usage", (int64_t)pcoinsTip->DynamicMemoryUsage()));
+    ret.push_back(Pair("hits", (int64_t)nHits));
+    ret.push_back(Pair("misses", (int64_t)nMisses));
+
+    CCoinsPrefetchStats stats = GetCoinsPrefetchStats();
+    UniValue prefetch(UniValue::VOBJ);
+    prefetch.push_back(Pair("blocks", (int64_t)stats.nBlocks));
+    prefetch.push_back(Pair("blocksused", (int64_t)stats.nBlocksUsed));
+    prefetch.push_back(Pair("coins", (int64_t)stats.nCoins));
+    prefetch.push_back(Pair("nullifiers", (int64_t)stats.nNullifiers));
+    prefetch.push_back(Pair("stale", (int64_t)stats.nStale));
+    ret.push_back(Pair("prefetch", prefetch));
+
+    CCoinsWriteStats writeStats = pcoinsdbview->GetWriteStats();
+    UniValue flush(UniValue::VOBJ);
+    flush.push_back(Pair("writes", (int64_t)writeStats.nWrites));
+    flush.push_back(Pair("pending", writeStats.fPending));
+    flush.push_back(Pair("lastduration", writeStats.nLastDuration));
+    flush.push_back(Pair("lastbytes", (int64_t)writeStats.nLastBytes));
+    flush.push_back(Pair("totalbytes", (int64_t)writeStats.nTotalBytes));
+    ret.push_back(Pair("flush", flush));
+    return ret;
+}
+
+UniValue getblockindexmemoryinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getblockindexmemoryinfo\n"
+            "\nReturns an estimate of the memory used by the block index.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"entries\": xxxxx           (numeric) Number of block index entries\n"
+            "  \"usage\": xxxxx             (numeric) Estimated memory usage of the block index, in bytes\n"
+            "  \"solutions\": xxxxx         (numeric) Number of entries holding their Equihash solution in memory\n"
+            "  \"solutionssaved\": xxxxx    (numeric) Bytes saved by reading the other solutions from disk on demand\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockindexmemoryinfo", "")
+            + HelpExampleRpc("getblockindexmemoryinfo", "")
+        );
+
+    LOCK(cs_main);
+
+    size_t nSolutionSize = 0;
+    size_t nSolutions = 0;
+    size_t nUsage = memusage::DynamicUsage(mapBlockIndex);
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex) {
+        const CBlockIndex* pindex = item.second;
+        nUsage += memusage::MallocUsage(sizeof(CBlockIndex));
+        // Holding cs_main, the solutions can be read directly
+        if (!pindex->nSolution.empty()) {
+            nSolutions++;
+            nSolutionSize = pindex->nSolution.size();
+            nUsage += memusage::DynamicUsage(pindex->nSolution);
+        }
+    }
+    if (nSolutionSize == 0 && chainActive.Tip() != NULL)
+        nSolutionSize = chainActive.Tip()->GetSolution().size();
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("entries", (uint64_t)mapBlockIndex.size()));
+    ret.push_back(Pair("usage", (uint64_t)nUsage));
+    ret.push_back(Pair("solutions", (uint64_t)nSolutions));
+    ret.push_back(Pair("solutionssaved", (uint64_t)((mapBlockIndex.size() - nSolutions) * memusage::MallocUsage(nSolutionSize))));
+    return ret;
+}
+
 UniValue invalidateblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -947,3 +1189,126 @@ UniValue reconsiderblock(const UniValue& params, bool fHelp)
 
     return NullUniValue;
 }
+
+static boost::filesystem::path SnapshotPath(const UniValue& param)
+{
+    boost::filesystem::path path(param.get_str());
+    if (!path.is_complete())
+        path = GetDataDir() / path;
+    return path;
+}
+
+UniValue dumptxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrites a snapshot of the chainstate (unspent outputs, nullifiers and note commitment tree anchors)\n"
+            "at the current tip to a file, which another node can load with loadtxoutset.\n"
+            "\nArguments:\n"
+            "1. \"path\"   (string, required) the file to write, relative to the data directory unless absolute\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"path\": \"path\",          (string) the file the snapshot was written to\n"
+            "  \"bestblock\": \"hex\",      (string) the block the snapshot was taken at\n"
+            "  \"height\": n,             (numeric) the height of that block\n"
+            "  \"muhash\": \"hash\",        (string) the UTXO set hash of the snapshot (see gettxoutsetinfo)\n"
+            "  \"transactions\": n,       (numeric) the number of transactions with unspent outputs\n"
+            "  \"nullifiers\": n,         (numeric) the number of nullifiers\n"
+            "  \"anchors\": n,            (numeric) the number of anchors\n"
+            "  \"bytes\": n               (numeric) the size of the file\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    boost::filesystem::path path = SnapshotPath(params[0]);
+    if (boost::filesystem::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+    boost::filesystem::path pathTmp = path.string() + ".incomplete";
+
+    CCoinsSnapshotMetadata metadata;
+    CCoinsSnapshotCounts counts;
+    CValidationState state;
+    {
+        CAutoFile file(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull())
+            throw JSONRPCError(RPC_MISC_ERROR, "Couldn't open " + pathTmp.string() + " for writing");
+        if (!DumpChainstateSnapshot(state, file, metadata, counts)) {
+            file.fclose();
+            boost::filesystem::remove(pathTmp);
+            throw JSONRPCError(RPC_DATABASE_ERROR, state.GetRejectReason());
+        }
+    }
+    boost::filesystem::rename(pathTmp, path);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("path", path.string()));
+    ret.push_back(Pair("bestblock", metadata.hashBlock.GetHex()));
+    ret.push_back(Pair("height", metadata.nHeight));
+    ret.push_back(Pair("muhash", metadata.hashUTXOSet.GetHex()));
+    ret.push_back(Pair("transactions", (uint64_t)counts.nCoins));
+    ret.push_back(Pair("nullifiers", (uint64_t)counts.nNullifiers));
+    ret.push_back(Pair("anchors", (uint64_t)counts.nAnchors));
+    ret.push_back(Pair("bytes", (uint64_t)boost::filesystem::file_size(path)));
+    return ret;
+}
+
+UniValue loadtxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "loadtxoutset \"path\" ( \"muhash\" )\n"
+            "\nReplaces the chainstate by a snapshot written by dumptxoutset, and continues syncing from its block.\n"
+            "Only possible while the node has no blocks but the genesis block connected, once the block headers up\n"
+            "to the snapshot block have been downloaded. The blocks before the snapshot aren't downloaded nor\n"
+            "validated, so the node trusts whoever made the snapshot: compare its UTXO set hash against the\n"
+            "one gettxoutsetinfo \"muhash\" reports at that block on a node you trust, or pass it as the second\n"
+            "argument. The node can't reorganize below the snapshot block, nor serve the blocks before it.\n"
+            "\nArguments:\n"
+            "1. \"path\"     (string, required) the snapshot file, relative to the data directory unless absolute\n"
+            "2. \"muhash\"   (string, optional) the UTXO set hash the snapshot must have\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"bestblock\": \"hex\",      (string) the block of the snapshot\n"
+            "  \"height\": n,             (numeric) the height of that block\n"
+            "  \"muhash\": \"hash\",        (string) the UTXO set hash of the snapshot\n"
+            "  \"transactions\": n,       (numeric) the number of transactions with unspent outputs\n"
+            "  \"nullifiers\": n,         (numeric) the number of nullifiers\n"
+            "  \"anchors\": n             (numeric) the number of anchors\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("loadtxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("loadtxoutset", "\"utxo.dat\", \"muhash\"")
+        );
+
+    boost::filesystem::path path = SnapshotPath(params[0]);
+    uint256 hashExpected;
+    if (params.size() > 1)
+        hashExpected = ParseHashV(params[1], "muhash");
+
+    CAutoFile file(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Couldn't open " + path.string());
+
+    CCoinsSnapshotMetadata metadata;
+    CCoinsSnapshotCounts counts;
+    CValidationState state;
+    if (!LoadChainstateSnapshot(state, file, params.size() > 1 ? &hashExpected : NULL, metadata, counts))
+        throw JSONRPCError(RPC_DATABASE_ERROR, state.GetRejectReason());
+    file.fclose();
+
+    ActivateBestChain(state);
+    if (!state.IsValid())
+        throw JSONRPCError(RPC_DATABASE_ERROR, state.GetRejectReason());
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("bestblock", metadata.hashBlock.GetHex()));
+    ret.push_back(Pair("height", metadata.nHeight));
+    ret.push_back(Pair("muhash", metadata.hashUTXOSet.GetHex()));
+    ret.push_back(Pair("transactions", (uint64_t)counts.nCoins));
+    ret.push_back(Pair("nullifiers", (uint64_t)counts.nNullifiers));
+    ret.push_back(Pair("anchors", (uint64_t)counts.nAnchors));
+    return ret;
+}
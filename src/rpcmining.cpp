@@ -343,6 +343,10 @@ UniValue getmininginfo(const UniValue& params, bool fHelp)
             "  \"localsolps\": xxx.xxxxx    (numeric) The average local solution rate in Sol/s since this node was started\n"
             "  \"networksolps\": x          (numeric) The estimated network solution rate in Sol/s\n"
             "  \"pooledtx\": n              (numeric) The size of the mem pool\n"
+            "  \"templatebuilds\": n        (numeric) The number of block templates made from scratch\n"
+            "  \"templatebuildtime\": xxx   (numeric) Milliseconds it took to make the last one\n"
+            "  \"templateupdates\": n       (numeric) The number of times getblocktemplate updated its template with the mem pool\n"
+            "  \"templateupdatetime\": xxx  (numeric) Milliseconds the last update took\n"
             "  \"testnet\": true|false      (boolean) If using testnet or not\n"
             "  \"chain\": \"xxxx\",         (string) current network name as defined in BIP70 (main, test, regtest)\n"
             "}\n"
@@ -365,6 +369,11 @@ UniValue getmininginfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("networksolps",     getnetworksolps(params, false)));
     obj.push_back(Pair("networkhashps",    getnetworksolps(params, false)));
     obj.push_back(Pair("pooledtx",         (uint64_t)mempool.size()));
+    CBlockTemplateStats templateStats = GetBlockTemplateStats();
+    obj.push_back(Pair("templatebuilds",     templateStats.nBuilds));
+    obj.push_back(Pair("templatebuildtime",  templateStats.nLastBuildTime * 0.001));
+    obj.push_back(Pair("templateupdates",    templateStats.nUpdates));
+    obj.push_back(Pair("templateupdatetime", templateStats.nLastUpdateTime * 0.001));
     obj.push_back(Pair("testnet",          Params().TestnetToBeDeprecatedFieldRPC()));
     obj.push_back(Pair("chain",            Params().NetworkIDString()));
 #ifdef ENABLE_MINING
@@ -616,10 +625,8 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
 
     // Update block
     static CBlockIndex* pindexPrev;
-    static int64_t nStart;
     static CBlockTemplate* pblocktemplate;
-    if (pindexPrev != chainActive.Tip() ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
+    if (pindexPrev != chainActive.Tip())
     {
         // Clear pindexPrev so future calls make a new block, despite any failures from here on
         pindexPrev = NULL;
@@ -627,7 +634,6 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
         // Store the pindexBest used before CreateNewBlockWithKey, to avoid races
         nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
         CBlockIndex* pindexPrevNew = chainActive.Tip();
-        nStart = GetTime();
 
         // Create new block
         if(pblocktemplate)
@@ -647,6 +653,13 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
         // Need to update only after we know CreateNewBlockWithKey succeeded
         pindexPrev = pindexPrevNew;
     }
+    else if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast)
+    {
+        // Same tip: follow the mempool, which is cheap enough to do on every call
+        nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+        if (!UpdateBlockTemplate(*pblocktemplate))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Block template is not on the current tip");
+    }
     CBlock* pblock = &pblocktemplate->block; // pointer for convenience
 
     // Update nTime
@@ -886,7 +886,6 @@ UniValue sendrawtransaction(const UniValue& params, bool fHelp)
             + HelpExampleRpc("sendrawtransaction", "\"signedhex\"")
         );
 
-    LOCK(cs_main);
     RPCTypeCheck(params, boost::assign::list_of(UniValue::VSTR)(UniValue::VBOOL));
 
     // parse hex string from parameter
@@ -899,6 +898,12 @@ UniValue sendrawtransaction(const UniValue& params, bool fHelp)
     if (params.size() > 1)
         fOverrideFees = params[1].get_bool();
 
+    // Verify the JoinSplits before taking cs_main
+    CValidationState statePreCheck;
+    if (!mempool.exists(hashTx) && !PreCheckTransaction(tx, statePreCheck))
+        throw JSONRPCError(RPC_TRANSACTION_REJECTED, strprintf("%i: %s", statePreCheck.GetRejectCode(), statePreCheck.GetRejectReason()));
+
+    LOCK(cs_main);
     CCoinsViewCache &view = *pcoinsTip;
     const CCoins* existingCoins = view.AccessCoins(hashTx);
     bool fHaveMempool = mempool.exists(hashTx);
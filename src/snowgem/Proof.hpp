@@ -4,6 +4,8 @@
 #include "serialize.h"
 #include "uint256.h"
 
+#include <memory>
+
 namespace libsnowgem {
 
 const unsigned char G1_PREFIX_MASK = 0x02;
@@ -237,13 +239,20 @@ public:
 
 void initialize_curve_params();
 
+class ProofBatch;
+
 class ProofVerifier {
 private:
     bool perform_verification;
 
-    ProofVerifier(bool perform_verification) : perform_verification(perform_verification) { }
+    // Proofs accumulated by check() in batch mode
+    std::unique_ptr<ProofBatch> batch;
+
+    ProofVerifier(bool perform_verification, bool batched);
 
 public:
+    ~ProofVerifier();
+
     // ProofVerifier should never be copied
     ProofVerifier(const ProofVerifier&) = delete;
     ProofVerifier& operator=(const ProofVerifier&) = delete;
@@ -259,6 +268,20 @@ public:
     // such as during reindexing.
     static ProofVerifier Disabled();
 
+    // Creates a verification context that only performs
+    // cheap sanity checks in check() and accumulates the
+    // proofs, so that they can all be verified at once by
+    // VerifyBatch(). check() returns false for proofs that
+    // cannot be batched; those must be verified strictly.
+    static ProofVerifier Batch();
+
+    // Verifies all proofs accumulated since Batch() with a
+    // single multi-pairing check, combining them with random
+    // coefficients. Returns false if any of them is invalid,
+    // in which case the proofs have to be verified one by one
+    // with a Strict() verifier to find the invalid ones.
+    bool VerifyBatch();
+
     template <typename VerificationKey,
               typename ProcessedVerificationKey,
               typename PrimaryInput,
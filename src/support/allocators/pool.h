@@ -0,0 +1,213 @@
+// Copyright (c) 2017-2018 The SnowGem developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include "memusage.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#include <boost/unordered_map.hpp>
+
+/**
+ * Memory resource for node based containers. Blocks of up to MAX_BLOCK_SIZE
+ * bytes are carved out of CHUNK_SIZE byte chunks, and blocks that are freed
+ * are kept in a free list per size to be handed out again. The chunks are
+ * only released when the resource is destroyed, all at once. Larger
+ * allocations (such as the bucket array of a hash table) are passed on to
+ * operator new.
+ *
+ * This turns one heap allocation per node into one per few thousand nodes,
+ * and makes the memory used by a container exactly known.
+ *
+ * Not thread-safe.
+ */
+class PoolResource
+{
+public:
+    static const size_t ALIGNMENT = 8;
+    static const size_t MAX_BLOCK_SIZE = 512;
+    static const size_t CHUNK_SIZE = 256 * 1024;
+
+private:
+    struct ListNode
+    {
+        ListNode* next;
+    };
+
+    //! Free blocks, by size in units of ALIGNMENT
+    std::vector<ListNode*> vFreeLists;
+    std::vector<char*> vChunks;
+    //! The part of the last chunk that was never handed out
+    char* pAvailableBegin;
+    char* pAvailableEnd;
+    //! Memory used by allocations larger than MAX_BLOCK_SIZE
+    size_t nLargeUsage;
+    uint64_t nHeapAllocations;
+
+    PoolResource(const PoolResource&);
+    PoolResource& operator=(const PoolResource&);
+
+    static size_t Units(size_t nBytes)
+    {
+        return nBytes == 0 ? 1 : (nBytes + ALIGNMENT - 1) / ALIGNMENT;
+    }
+
+    void PushFree(void* p, size_t nUnits)
+    {
+        ListNode* node = static_cast<ListNode*>(p);
+        node->next = vFreeLists[nUnits];
+        vFreeLists[nUnits] = node;
+    }
+
+    void AllocateChunk()
+    {
+        // Hand the rest of the current chunk out as a free block
+        size_t nRemaining = (pAvailableEnd - pAvailableBegin) / ALIGNMENT;
+        if (nRemaining > 0)
+            PushFree(pAvailableBegin, nRemaining);
+
+        char* chunk = static_cast<char*>(::operator new(CHUNK_SIZE));
+        vChunks.push_back(chunk);
+        nHeapAllocations++;
+        pAvailableBegin = chunk;
+        pAvailableEnd = chunk + CHUNK_SIZE;
+    }
+
+public:
+    PoolResource() : vFreeLists(MAX_BLOCK_SIZE / ALIGNMENT + 1, NULL), pAvailableBegin(NULL), pAvailableEnd(NULL), nLargeUsage(0), nHeapAllocations(0) {}
+
+    ~PoolResource()
+    {
+        for (size_t i = 0; i < vChunks.size(); i++)
+            ::operator delete(vChunks[i]);
+    }
+
+    void* Allocate(size_t nBytes)
+    {
+        if (nBytes > MAX_BLOCK_SIZE) {
+            void* p = ::operator new(nBytes);
+            nLargeUsage += memusage::MallocUsage(nBytes);
+            nHeapAllocations++;
+            return p;
+        }
+        size_t nUnits = Units(nBytes);
+        if (vFreeLists[nUnits] != NULL) {
+            ListNode* node = vFreeLists[nUnits];
+            vFreeLists[nUnits] = node->next;
+            return node;
+        }
+        if ((size_t)(pAvailableEnd - pAvailableBegin) < nUnits * ALIGNMENT)
+            AllocateChunk();
+        void* p = pAvailableBegin;
+        pAvailableBegin += nUnits * ALIGNMENT;
+        return p;
+    }
+
+    void Deallocate(void* p, size_t nBytes)
+    {
+        if (nBytes > MAX_BLOCK_SIZE) {
+            nLargeUsage -= memusage::MallocUsage(nBytes);
+            ::operator delete(p);
+            return;
+        }
+        PushFree(p, Units(nBytes));
+    }
+
+    //! Memory allocated from the heap, including the resource's own bookkeeping
+    size_t DynamicMemoryUsage() const
+    {
+        return vChunks.size() * memusage::MallocUsage(CHUNK_SIZE) + nLargeUsage +
+               memusage::DynamicUsage(vChunks) + memusage::DynamicUsage(vFreeLists);
+    }
+
+    size_t NumChunks() const { return vChunks.size(); }
+
+    //! Number of heap allocations made so far (chunks and large allocations).
+    //! Allocations made by the stored values themselves are not included.
+    uint64_t GetHeapAllocations() const { return nHeapAllocations; }
+};
+
+/**
+ * Allocator drawing from a PoolResource. Each allocator that isn't copied
+ * from another one creates its own resource, and containers take their
+ * allocator (and thus memory) along when they are swapped or moved; copies
+ * of a container get a resource of their own.
+ */
+template <typename T>
+class PoolAllocator
+{
+    std::shared_ptr<PoolResource> resource;
+
+    template <typename U>
+    friend class PoolAllocator;
+
+public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+    typedef std::false_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U> other;
+    };
+
+    static_assert(std::alignment_of<T>::value <= PoolResource::ALIGNMENT, "PoolResource doesn't support this alignment");
+
+    PoolAllocator() : resource(std::make_shared<PoolResource>()) {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& other) : resource(other.resource) {}
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(resource->Allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        resource->Deallocate(p, n * sizeof(T));
+    }
+
+    PoolAllocator select_on_container_copy_construction() const
+    {
+        return PoolAllocator();
+    }
+
+    const PoolResource& GetResource() const { return *resource; }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>& other) const { return resource == other.resource; }
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>& other) const { return resource != other.resource; }
+};
+
+namespace memusage
+{
+
+//! The memory of a pool allocated map is exactly that of its resource
+template <typename X, typename Y, typename Z, typename P, typename A>
+static inline size_t DynamicUsage(const boost::unordered_map<X, Y, Z, P, PoolAllocator<A> >& m)
+{
+    return m.get_allocator().GetResource().DynamicMemoryUsage();
+}
+
+}
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
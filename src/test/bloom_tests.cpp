@@ -537,4 +537,40 @@ BOOST_AUTO_TEST_CASE(rolling_bloom)
     }
 }
 
+BOOST_AUTO_TEST_CASE(blocked_bloom)
+{
+    static const int DATASIZE = 10000;
+    CBlockedBloomFilter filter(DATASIZE);
+
+    std::vector<uint256> data;
+    for (int i = 0; i < DATASIZE; i++) {
+        data.push_back(GetRandHash());
+        filter.insert(data.back());
+    }
+    BOOST_CHECK_EQUAL(filter.GetInsertions(), (unsigned int)DATASIZE);
+
+    // No false negatives, also after a serialization roundtrip
+    CDataStream stream(SER_DISK, CLIENT_VERSION);
+    stream << filter;
+    CBlockedBloomFilter filter2;
+    stream >> filter2;
+    for (int i = 0; i < DATASIZE; i++) {
+        BOOST_CHECK(filter.contains(data[i]));
+        BOOST_CHECK(filter2.contains(data[i]));
+    }
+
+    // Filled to capacity, the false positive rate should be around 0.2%
+    unsigned int nHits = 0;
+    for (int i = 0; i < 100000; i++) {
+        if (filter.contains(GetRandHash()))
+            ++nHits;
+    }
+    BOOST_TEST_MESSAGE("BlockedBloomFilter got " << nHits << " false positives (~200 expected)");
+    BOOST_CHECK(nHits < 1000);
+
+    // A default-constructed filter can't rule anything out
+    CBlockedBloomFilter empty;
+    BOOST_CHECK(empty.contains(GetRandHash()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "arith_uint256.h"
 #include "clientversion.h"
 #include "consensus/validation.h"
 #include "main.h"
@@ -64,4 +65,33 @@ BOOST_AUTO_TEST_CASE(May15)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(CachedHeaderHash)
+{
+    CBlockHeader header;
+    header.nTime = 1368576000;
+    header.nBits = 0x1f07ffff;
+    header.nSolution = std::vector<unsigned char>(1344, 0x5a);
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << header;
+    CBlockHeader read;
+    ss >> read;
+    BOOST_CHECK(read.GetHash() == SerializeHash(header));
+
+    // Any change to the header must invalidate the cached hash
+    read.nNonce = ArithToUint256(UintToArith256(read.nNonce) + 1);
+    BOOST_CHECK(read.GetHash() == SerializeHash(read));
+    BOOST_CHECK(read.GetHash() != SerializeHash(header));
+    read.nNonce = header.nNonce;
+    BOOST_CHECK(read.GetHash() == SerializeHash(header));
+    read.nSolution[0] ^= 1;
+    BOOST_CHECK(read.GetHash() == SerializeHash(read));
+    BOOST_CHECK(read.GetHash() != SerializeHash(header));
+
+    // Copies carry the cached hash along with the fields
+    CBlock block(header);
+    CBlockHeader copy = block.GetBlockHeader();
+    BOOST_CHECK(copy.GetHash() == block.GetHash());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -8,6 +8,7 @@
 #include "uint256.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
+#include "txdb.h"
 #include "consensus/validation.h"
 #include "main.h"
 #include "undo.h"
@@ -136,6 +137,13 @@ class CCoinsViewCacheTest : public CCoinsViewCache
 public:
     CCoinsViewCacheTest(CCoinsView* base) : CCoinsViewCache(base) {}
 
+    uint64_t GetHeapAllocations() const
+    {
+        return cacheCoins.get_allocator().GetResource().GetHeapAllocations() +
+               cacheAnchors.get_allocator().GetResource().GetHeapAllocations() +
+               cacheNullifiers.get_allocator().GetResource().GetHeapAllocations();
+    }
+
     void SelfTest() const
     {
         // Manually recompute the dynamic usage of the whole data, and compare it.
@@ -143,7 +151,7 @@ public:
                      memusage::DynamicUsage(cacheAnchors) +
                      memusage::DynamicUsage(cacheNullifiers);
         for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
-            ret += it->second.coins.DynamicMemoryUsage();
+            ret += it->second.DynamicMemoryUsage();
         }
         BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
     }
@@ -433,6 +441,251 @@ BOOST_AUTO_TEST_CASE(nullifiers_test)
     BOOST_CHECK(!cache3.GetNullifier(nf));
 }
 
+BOOST_AUTO_TEST_CASE(warm_cache_test)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+
+    uint256 txid = GetRandHash();
+    uint256 nf = GetRandHash();
+    uint64_t nHits, nMisses;
+
+    // Entries read elsewhere are served from the cache afterwards
+    CCoins coins;
+    coins.vout.resize(1);
+    coins.vout[0].nValue = 42;
+    BOOST_CHECK(cache.WarmCoins(txid, coins));
+    BOOST_CHECK(coins.vout.empty());
+    BOOST_CHECK(cache.WarmNullifier(nf, true));
+    cache.SelfTest();
+
+    const CCoins* pcoins = cache.AccessCoins(txid);
+    BOOST_CHECK(pcoins && pcoins->vout[0].nValue == 42);
+    BOOST_CHECK(cache.GetNullifier(nf));
+    cache.GetHitStats(nHits, nMisses);
+    BOOST_CHECK_EQUAL(nHits, 1U);
+    BOOST_CHECK_EQUAL(nMisses, 0U);
+
+    // They never replace what is already cached, which may be newer
+    cache.ModifyCoins(txid)->vout[0].nValue = 43;
+    CCoins stale;
+    stale.vout.resize(1);
+    stale.vout[0].nValue = 42;
+    BOOST_CHECK(!cache.WarmCoins(txid, stale));
+    BOOST_CHECK_EQUAL(cache.AccessCoins(txid)->vout[0].nValue, 43);
+    cache.SetNullifier(nf, false);
+    BOOST_CHECK(!cache.WarmNullifier(nf, true));
+    BOOST_CHECK(!cache.GetNullifier(nf));
+    cache.SelfTest();
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_pool_test)
+{
+    // Freed blocks are reused, and small blocks share chunks
+    PoolResource resource;
+    void* a = resource.Allocate(40);
+    resource.Deallocate(a, 40);
+    BOOST_CHECK(resource.Allocate(33) == a);
+    for (int i = 0; i < 1000; i++)
+        resource.Allocate(100);
+    BOOST_CHECK_EQUAL(resource.NumChunks(), 1U);
+    BOOST_CHECK_EQUAL(resource.GetHeapAllocations(), 1U);
+
+    // Large allocations are passed on, and accounted for
+    size_t nUsage = resource.DynamicMemoryUsage();
+    size_t nLarge = PoolResource::MAX_BLOCK_SIZE + 1;
+    void* b = resource.Allocate(nLarge);
+    BOOST_CHECK_EQUAL(resource.DynamicMemoryUsage(), nUsage + memusage::MallocUsage(nLarge));
+    resource.Deallocate(b, nLarge);
+    BOOST_CHECK_EQUAL(resource.DynamicMemoryUsage(), nUsage);
+
+    // A cache makes a few heap allocations for many entries, and releases
+    // them when flushed
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+    size_t nEmptyUsage = cache.DynamicMemoryUsage();
+    for (int i = 0; i < 10000; i++) {
+        {
+            CCoinsModifier coins = cache.ModifyCoins(GetRandHash());
+            coins->vout.resize(1);
+            coins->vout[0].nValue = i + 1;
+        }
+        cache.SetNullifier(GetRandHash(), true);
+    }
+    cache.SelfTest();
+    BOOST_CHECK(cache.GetHeapAllocations() < 100);
+    BOOST_CHECK(cache.DynamicMemoryUsage() > nEmptyUsage + 10000 * sizeof(CCoinsCacheEntry));
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), nEmptyUsage);
+    BOOST_CHECK_EQUAL(cache.GetHeapAllocations(), 0U);
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_db_per_output_test, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    uint256 txid = GetRandHash();
+    CCoins coins;
+    coins.nVersion = 1;
+    coins.nHeight = 100;
+    coins.vout.resize(300);
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        coins.vout[i].nValue = i + 1;
+        coins.vout[i].scriptPubKey = CScript() << OP_TRUE;
+    }
+
+    {
+        CCoinsViewCache cache(&db);
+        *cache.ModifyCoins(txid) = coins;
+        BOOST_CHECK(cache.Flush());
+    }
+    CCoins read;
+    BOOST_CHECK(db.GetCoins(txid, read));
+    BOOST_CHECK(read == coins);
+
+    // Spending outputs only erases those
+    {
+        CCoinsViewCache cache(&db);
+        cache.ModifyCoins(txid)->Spend(1);
+        cache.ModifyCoins(txid)->Spend(299);
+        BOOST_CHECK(cache.Flush());
+    }
+    coins.Spend(1);
+    coins.Spend(299);
+    BOOST_CHECK(db.GetCoins(txid, read));
+    BOOST_CHECK(read == coins);
+    BOOST_CHECK_EQUAL(read.vout.size(), 299U);
+
+    // Moving the transaction to another height rewrites the other outputs
+    {
+        CCoinsViewCache cache(&db);
+        cache.ModifyCoins(txid)->nHeight = 200;
+        BOOST_CHECK(cache.Flush());
+    }
+    coins.nHeight = 200;
+    BOOST_CHECK(db.GetCoins(txid, read));
+    BOOST_CHECK(read == coins);
+
+    // Nothing is left once all outputs are spent
+    {
+        CCoinsViewCache cache(&db);
+        {
+            CCoinsModifier modifier = cache.ModifyCoins(txid);
+            for (unsigned int i = 0; i < coins.vout.size(); i++)
+                modifier->Spend(i);
+        }
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(!db.HaveCoins(txid));
+    BOOST_CHECK(!db.GetCoins(txid, read));
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_db_new_coins_test, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    uint256 txid = GetRandHash();
+    CCoins coins;
+    coins.nVersion = 1;
+    coins.nHeight = 100;
+    coins.vout.resize(3);
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        coins.vout[i].nValue = i + 1;
+        coins.vout[i].scriptPubKey = CScript() << OP_TRUE;
+    }
+
+    // Outputs of a new transaction are written without reading them first
+    {
+        CCoinsViewCacheTest cache(&db);
+        *cache.ModifyNewCoins(txid) = coins;
+        cache.SelfTest();
+        BOOST_CHECK(cache.Flush());
+    }
+    CCoins read;
+    BOOST_CHECK(db.GetCoins(txid, read));
+    BOOST_CHECK(read == coins);
+
+    // A transaction that is disconnected and connected again in the same
+    // view keeps the outputs the database has, so none are left behind
+    {
+        CCoinsViewCacheTest cache(&db);
+        cache.ModifyCoins(txid)->Clear();
+        {
+            CCoinsModifier modifier = cache.ModifyNewCoins(txid);
+            *modifier = coins;
+            modifier->nHeight = 200;
+            modifier->Spend(2);
+        }
+        cache.SelfTest();
+        BOOST_CHECK(cache.Flush());
+    }
+    coins.nHeight = 200;
+    coins.Spend(2);
+    BOOST_CHECK(db.GetCoins(txid, read));
+    BOOST_CHECK(read == coins);
+    BOOST_CHECK_EQUAL(read.vout.size(), 2U);
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_db_anchor_pruning_test, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    ZCIncrementalMerkleTree tree;
+    appendRandomCommitment(tree);
+    uint256 rt1 = tree.root();
+    {
+        CCoinsViewCache cache(&db);
+        cache.PushAnchor(tree);
+        appendRandomCommitment(tree);
+        cache.PushAnchor(tree);
+        BOOST_CHECK(cache.Flush());
+    }
+    uint256 rt2 = tree.root();
+
+    CAnchorStats stats;
+    BOOST_CHECK(db.GetAnchorStats(stats));
+    BOOST_CHECK_EQUAL(stats.nAnchors, 2U);
+    BOOST_CHECK_EQUAL(stats.nPruned, 0U);
+    BOOST_CHECK_EQUAL(db.GetAnchorsPrunedHeight(), 0);
+
+    // Pruning goes along with the next batch
+    CAnchorPruning pruning;
+    pruning.vAnchors.push_back(std::make_pair(rt1, 5));
+    pruning.nHeight = 10;
+    db.SetAnchorPruning(pruning);
+    BOOST_CHECK_EQUAL(db.GetAnchorsPrunedHeight(), 10);
+    ZCIncrementalMerkleTree read;
+    BOOST_CHECK(db.ReadAnchor(rt1, read));
+    {
+        CCoinsViewCache cache(&db);
+        BOOST_CHECK(cache.Flush());
+    }
+
+    BOOST_CHECK(!db.ReadAnchor(rt1, read));
+    BOOST_CHECK(db.ReadAnchor(rt2, read));
+    BOOST_CHECK(read.root() == rt2);
+    BOOST_CHECK(db.GetAnchorStats(stats));
+    BOOST_CHECK_EQUAL(stats.nAnchors, 1U);
+    BOOST_CHECK_EQUAL(stats.nPruned, 1U);
+    BOOST_CHECK_EQUAL(stats.nPrunedHeight, 10);
+    BOOST_CHECK_EQUAL(db.GetAnchorsPrunedHeight(), 10);
+
+    // The active chain doesn't have the blocks that created it, so its tree
+    // can't be recomputed
+    BOOST_CHECK(!db.GetAnchorAt(rt1, read));
+
+    // Popping a pruned anchor forgets it entirely
+    {
+        CAnchorsMap mapAnchors;
+        CAnchorsCacheEntry& entry = mapAnchors[rt1];
+        entry.entered = false;
+        entry.flags = CAnchorsCacheEntry::DIRTY;
+        CCoinsMap mapCoins;
+        CNullifiersMap mapNullifiers;
+        BOOST_CHECK(db.BatchWrite(mapCoins, uint256(), uint256(), mapAnchors, mapNullifiers));
+    }
+    BOOST_CHECK(db.GetAnchorStats(stats));
+    BOOST_CHECK_EQUAL(stats.nPruned, 0U);
+}
+
 BOOST_AUTO_TEST_CASE(anchors_flush_test)
 {
     CCoinsViewTest base;
@@ -0,0 +1,105 @@
+// Copyright (c) 2017-2018 The SnowGem developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinstats.h"
+
+#include "clientversion.h"
+#include "coins.h"
+#include "random.h"
+#include "script/script.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(coinstats_tests, BasicTestingSetup)
+
+static std::vector<unsigned char> Element(unsigned char c)
+{
+    return std::vector<unsigned char>(32, c);
+}
+
+BOOST_AUTO_TEST_CASE(muhash)
+{
+    MuHash3072 empty;
+    MuHash3072 a, b;
+    a.Insert(Element(1)).Insert(Element(2)).Insert(Element(3));
+    b.Insert(Element(3)).Insert(Element(1)).Insert(Element(2));
+    BOOST_CHECK(a.Finalize() == b.Finalize());
+    BOOST_CHECK(a.Finalize() != empty.Finalize());
+
+    // Removing an element undoes inserting it, in any order
+    b.Remove(Element(2));
+    MuHash3072 c;
+    c.Remove(Element(2)).Insert(Element(2)).Insert(Element(1)).Insert(Element(3)).Remove(Element(2));
+    c.Insert(Element(2)).Remove(Element(2));
+    BOOST_CHECK(b.Finalize() == c.Finalize());
+    b.Remove(Element(1)).Remove(Element(3));
+    BOOST_CHECK(b.Finalize() == empty.Finalize());
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << a;
+    MuHash3072 d;
+    ss >> d;
+    BOOST_CHECK(a.Finalize() == d.Finalize());
+    d.Remove(Element(1));
+    BOOST_CHECK(a.Finalize() != d.Finalize());
+}
+
+BOOST_AUTO_TEST_CASE(utxostats_update)
+{
+    uint256 txid = GetRandHash();
+    CCoins coins;
+    coins.nVersion = 1;
+    coins.nHeight = 100;
+    coins.fCoinBase = false;
+    coins.vout.resize(3);
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        coins.vout[i].nValue = (i + 1) * COIN;
+        coins.vout[i].scriptPubKey = CScript() << OP_TRUE;
+    }
+
+    CUTXOStats empty;
+    CUTXOStats stats;
+    stats.UpdateCoins(txid, NULL, &coins);
+    BOOST_CHECK_EQUAL(stats.nTransactions, 1);
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, 3);
+    BOOST_CHECK_EQUAL(stats.nTotalAmount, 6 * COIN);
+    BOOST_CHECK_EQUAL(stats.nSerializedSize, 32 + ::GetSerializeSize(coins, SER_DISK, CLIENT_VERSION));
+
+    // Spending an output only removes that output
+    CCoins spent = coins;
+    spent.Spend(1);
+    stats.UpdateCoins(txid, &coins, &spent);
+    CUTXOStats expected;
+    expected.UpdateCoins(txid, NULL, &spent);
+    BOOST_CHECK_EQUAL(stats.nTransactions, 1);
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, 2);
+    BOOST_CHECK_EQUAL(stats.nTotalAmount, 4 * COIN);
+    BOOST_CHECK_EQUAL(stats.nSerializedSize, expected.nSerializedSize);
+    BOOST_CHECK(stats.muhash.Finalize() == expected.muhash.Finalize());
+
+    // The height of the transaction is part of the hash
+    CCoins other = spent;
+    other.nHeight++;
+    CUTXOStats otherStats;
+    otherStats.UpdateCoins(txid, NULL, &other);
+    BOOST_CHECK(otherStats.muhash.Finalize() != expected.muhash.Finalize());
+
+    // Spending the remaining outputs empties the set again
+    CCoins pruned = spent;
+    pruned.Spend(0);
+    pruned.Spend(2);
+    BOOST_CHECK(pruned.IsPruned());
+    stats.UpdateCoins(txid, &spent, &pruned);
+    BOOST_CHECK_EQUAL(stats.nTransactions, 0);
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, 0);
+    BOOST_CHECK_EQUAL(stats.nTotalAmount, 0);
+    BOOST_CHECK_EQUAL(stats.nSerializedSize, 0);
+    BOOST_CHECK(stats.muhash.Finalize() == empty.muhash.Finalize());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,8 @@
 #include "test/test_bitcoin.h"
 
 #include <boost/test/unit_test.hpp>
+#include <algorithm>
+#include <limits>
 #include <list>
 
 BOOST_FIXTURE_TEST_SUITE(mempool_tests, TestingSetup)
@@ -101,4 +103,281 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+template<typename name>
+static void CheckSort(CTxMemPool &pool, const std::vector<std::string> &sortedOrder)
+{
+    BOOST_CHECK_EQUAL(pool.size(), sortedOrder.size());
+    typename CTxMemPool::indexed_transaction_set::index<name>::type::iterator it = pool.mapTx.get<name>().begin();
+    int count = 0;
+    for (; it != pool.mapTx.get<name>().end(); ++it, ++count) {
+        BOOST_CHECK_EQUAL(it->GetTx().GetHash().ToString(), sortedOrder[count]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+
+    // Three transactions of the same size, and a larger one paying the
+    // highest fee but at the lowest rate
+    CMutableTransaction tx[4];
+    CAmount fees[4] = {10000, 20000, 15000, 30000};
+    int64_t times[4] = {3, 1, 2, 4};
+    for (int i = 0; i < 4; i++) {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].prevout.hash = GetRandHash();
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        tx[i].vout.resize(i == 3 ? 20 : 1);
+        for (unsigned int j = 0; j < tx[i].vout.size(); j++) {
+            tx[i].vout[j].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+            tx[i].vout[j].nValue = 10 * COIN;
+        }
+        pool.addUnchecked(tx[i].GetHash(), CTxMemPoolEntry(tx[i], fees[i], times[i], 0.0, 1));
+    }
+
+    std::vector<std::string> sortedOrder;
+    sortedOrder.push_back(tx[3].GetHash().ToString());
+    sortedOrder.push_back(tx[0].GetHash().ToString());
+    sortedOrder.push_back(tx[2].GetHash().ToString());
+    sortedOrder.push_back(tx[1].GetHash().ToString());
+    CheckSort<descendant_score>(pool, sortedOrder);
+    std::reverse(sortedOrder.begin(), sortedOrder.end());
+    CheckSort<ancestor_score>(pool, sortedOrder);
+
+    sortedOrder.clear();
+    sortedOrder.push_back(tx[1].GetHash().ToString());
+    sortedOrder.push_back(tx[2].GetHash().ToString());
+    sortedOrder.push_back(tx[0].GetHash().ToString());
+    sortedOrder.push_back(tx[3].GetHash().ToString());
+    CheckSort<entry_time>(pool, sortedOrder);
+
+    // Prioritising moves a transaction in both fee rate orders
+    pool.PrioritiseTransaction(tx[0].GetHash(), tx[0].GetHash().ToString(), 0.0, 20000);
+    sortedOrder.clear();
+    sortedOrder.push_back(tx[0].GetHash().ToString());
+    sortedOrder.push_back(tx[1].GetHash().ToString());
+    sortedOrder.push_back(tx[2].GetHash().ToString());
+    sortedOrder.push_back(tx[3].GetHash().ToString());
+    CheckSort<ancestor_score>(pool, sortedOrder);
+    std::reverse(sortedOrder.begin(), sortedOrder.end());
+    CheckSort<descendant_score>(pool, sortedOrder);
+
+    // Deltas given before a transaction arrives apply once it does
+    CMutableTransaction txLate = tx[2];
+    txLate.vin[0].prevout.hash = GetRandHash();
+    pool.PrioritiseTransaction(txLate.GetHash(), txLate.GetHash().ToString(), 0.0, 100000);
+    pool.addUnchecked(txLate.GetHash(), CTxMemPoolEntry(txLate, 0, 5, 0.0, 1));
+    BOOST_CHECK(pool.mapTx.get<ancestor_score>().begin()->GetTx().GetHash() == txLate.GetHash());
+    BOOST_CHECK(pool.mapTx.get<descendant_score>().rbegin()->GetTx().GetHash() == txLate.GetHash());
+}
+
+static void CheckPackage(CTxMemPool& pool, const CMutableTransaction& tx,
+                         uint64_t nAncestors, CAmount nAncestorFees,
+                         uint64_t nDescendants, CAmount nDescendantFees)
+{
+    const CTxMemPoolEntry& entry = *pool.mapTx.find(tx.GetHash());
+    BOOST_CHECK_EQUAL(entry.GetCountWithAncestors(), nAncestors);
+    BOOST_CHECK_EQUAL(entry.GetSizeWithAncestors(), nAncestors * entry.GetTxSize());
+    BOOST_CHECK_EQUAL(entry.GetModFeesWithAncestors(), nAncestorFees);
+    BOOST_CHECK_EQUAL(entry.GetCountWithDescendants(), nDescendants);
+    BOOST_CHECK_EQUAL(entry.GetSizeWithDescendants(), nDescendants * entry.GetTxSize());
+    BOOST_CHECK_EQUAL(entry.GetModFeesWithDescendants(), nDescendantFees);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolPackageTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+
+    // A chain of three transactions of the same size, the last one paying
+    // for the other two
+    CMutableTransaction tx[3];
+    CAmount fees[3] = {1000, 2000, 30000};
+    for (int i = 0; i < 3; i++) {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].prevout.hash = i == 0 ? GetRandHash() : tx[i - 1].GetHash();
+        tx[i].vin[0].prevout.n = 0;
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10 * COIN;
+    }
+    for (int i = 0; i < 3; i++)
+        pool.addUnchecked(tx[i].GetHash(), CTxMemPoolEntry(tx[i], fees[i], 0, 0.0, 1));
+
+    CheckPackage(pool, tx[0], 1, 1000, 3, 33000);
+    CheckPackage(pool, tx[1], 2, 3000, 2, 32000);
+    CheckPackage(pool, tx[2], 3, 33000, 1, 30000);
+
+    // The last one is mined first, with its ancestors; the first one is
+    // evicted first, with its descendants
+    BOOST_CHECK(pool.mapTx.get<ancestor_score>().begin()->GetTx().GetHash() == tx[2].GetHash());
+    BOOST_CHECK(pool.mapTx.get<descendant_score>().begin()->GetTx().GetHash() == tx[0].GetHash());
+
+    // Fee deltas count in the packages
+    pool.PrioritiseTransaction(tx[1].GetHash(), tx[1].GetHash().ToString(), 0.0, 3000);
+    CheckPackage(pool, tx[0], 1, 1000, 3, 36000);
+    CheckPackage(pool, tx[1], 2, 6000, 2, 35000);
+    CheckPackage(pool, tx[2], 3, 36000, 1, 30000);
+
+    // Package limits, for a fourth transaction in the chain
+    CMutableTransaction txNext = tx[2];
+    txNext.vin[0].prevout.hash = tx[2].GetHash();
+    CTxMemPoolEntry entryNext(txNext, 0, 0, 0.0, 1);
+    CTxMemPoolEntry::Links setAncestors;
+    std::string errString;
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(entryNext, setAncestors, 4, nNoLimit, nNoLimit, nNoLimit, errString));
+    BOOST_CHECK_EQUAL(setAncestors.size(), 3);
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(entryNext, setAncestors, 3, nNoLimit, nNoLimit, nNoLimit, errString));
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(entryNext, setAncestors, nNoLimit, nNoLimit, 3, nNoLimit, errString));
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(entryNext, setAncestors, nNoLimit, 3 * entryNext.GetTxSize(), nNoLimit, nNoLimit, errString));
+
+    // Mining the first one takes it out of the packages of the others
+    std::list<CTransaction> removed;
+    pool.remove(tx[0], removed, false);
+    CheckPackage(pool, tx[1], 1, 5000, 2, 35000);
+    CheckPackage(pool, tx[2], 2, 35000, 1, 30000);
+
+    // Evicting the second one takes the third along
+    pool.remove(tx[1], removed, true);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+
+    // The transactions of a disconnected block come back after those
+    // spending them
+    for (int i = 2; i >= 0; i--)
+        pool.addUnchecked(tx[i].GetHash(), CTxMemPoolEntry(tx[i], fees[i], 0, 0.0, 1));
+    CheckPackage(pool, tx[0], 1, 1000, 3, 36000);
+    CheckPackage(pool, tx[1], 2, 6000, 2, 35000);
+    CheckPackage(pool, tx[2], 3, 36000, 1, 30000);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolLinksTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(2);
+    for (int i = 0; i < 2; i++) {
+        txParent.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txParent.vout[i].nValue = 33000LL;
+    }
+    CMutableTransaction txChild[2];
+    for (int i = 0; i < 2; i++) {
+        txChild[i].vin.resize(1);
+        txChild[i].vin[0].scriptSig = CScript() << OP_11;
+        txChild[i].vin[0].prevout.hash = txParent.GetHash();
+        txChild[i].vin[0].prevout.n = i;
+        txChild[i].vout.resize(1);
+        txChild[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txChild[i].vout[0].nValue = 11000LL;
+    }
+
+    size_t nEmptyUsage = pool.DynamicMemoryUsage();
+
+    // The children arrive first, as when the parent's block is disconnected
+    pool.addUnchecked(txChild[0].GetHash(), CTxMemPoolEntry(txChild[0], 0, 0, 0.0, 1));
+    pool.addUnchecked(txChild[1].GetHash(), CTxMemPoolEntry(txChild[1], 0, 0, 0.0, 1));
+    BOOST_CHECK(pool.mapTx.find(txChild[0].GetHash())->GetMemPoolParents().empty());
+    pool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 0, 0, 0.0, 1));
+
+    const CTxMemPoolEntry& parent = *pool.mapTx.find(txParent.GetHash());
+    BOOST_CHECK(parent.GetMemPoolParents().empty());
+    BOOST_CHECK_EQUAL(parent.GetMemPoolChildren().size(), 2);
+    for (int i = 0; i < 2; i++) {
+        const CTxMemPoolEntry& child = *pool.mapTx.find(txChild[i].GetHash());
+        BOOST_CHECK_EQUAL(child.GetMemPoolParents().size(), 1);
+        BOOST_CHECK(*child.GetMemPoolParents().begin() == &parent);
+        BOOST_CHECK(parent.GetMemPoolChildren().count(&child));
+    }
+
+    // Mining the parent leaves the children without links
+    std::list<CTransaction> removed;
+    pool.remove(txParent, removed, false);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    for (int i = 0; i < 2; i++)
+        BOOST_CHECK(pool.mapTx.find(txChild[i].GetHash())->GetMemPoolParents().empty());
+
+    pool.remove(txChild[0], removed, false);
+    pool.remove(txChild[1], removed, false);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), nEmptyUsage);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    SetMockTime(42);
+    CTxMemPool pool(CFeeRate(0));
+
+    // An independent transaction, and a cheap parent with a child paying
+    // for both
+    CMutableTransaction tx1, txParent, txChild;
+    tx1.vin.resize(1);
+    tx1.vin[0].prevout.hash = GetRandHash();
+    tx1.vin[0].scriptSig = CScript() << OP_11;
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    txParent = tx1;
+    txParent.vin[0].prevout.hash = GetRandHash();
+    txChild = tx1;
+    txChild.vin[0].prevout.hash = txParent.GetHash();
+    txChild.vin[0].prevout.n = 0;
+    pool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 10000, 10, 0.0, 1));
+    pool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 1000, 20, 0.0, 1));
+    pool.addUnchecked(txChild.GetHash(), CTxMemPoolEntry(txChild, 30000, 30, 0.0, 1));
+    size_t nPackageSize = pool.mapTx.find(txParent.GetHash())->GetTxSize() + pool.mapTx.find(txChild.GetHash())->GetTxSize();
+
+    // Nothing is evicted while the pool is within its limit
+    pool.TrimToSize(pool.DynamicMemoryUsage());
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+    BOOST_CHECK(pool.GetMinFee(1) == CFeeRate(0));
+
+    // The child pays for the parent, so the independent transaction goes first
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(!pool.exists(tx1.GetHash()));
+    BOOST_CHECK(pool.exists(txParent.GetHash()));
+    BOOST_CHECK(pool.exists(txChild.GetHash()));
+    size_t nTxSize = nPackageSize / 2;
+    BOOST_CHECK(pool.GetMinFee(1) == CFeeRate(CFeeRate(10000, nTxSize).GetFeePerK() + ::minRelayTxFee.GetFeePerK()));
+
+    // The parent takes its child along
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+
+    // New transactions must beat the evicted package by the relay fee
+    CFeeRate rateRemoved(CFeeRate(31000, nPackageSize).GetFeePerK() + ::minRelayTxFee.GetFeePerK());
+    BOOST_CHECK(pool.GetMinFee(1) == rateRemoved);
+
+    // The minimum fee only decays once a block has been found
+    SetMockTime(42 + CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK(pool.GetMinFee(1) == rateRemoved);
+    SetMockTime(42);
+    std::vector<CTransaction> vtxBlock;
+    std::list<CTransaction> conflicts;
+    pool.removeForBlock(vtxBlock, 1, conflicts);
+    SetMockTime(42 + CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK(pool.GetMinFee(1) == CFeeRate((CAmount)(rateRemoved.GetFeePerK() / 2.0)));
+
+    // ... and falls back to zero once well below the relay fee
+    SetMockTime(42 + 100 * CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK(pool.GetMinFee(1) == CFeeRate(0));
+
+    // Expiry removes transactions that entered the pool before the given time
+    CMutableTransaction tx2 = tx1;
+    tx2.vin[0].prevout.hash = GetRandHash();
+    pool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 10000, 10, 0.0, 1));
+    pool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 10000, 100, 0.0, 1));
+    BOOST_CHECK_EQUAL(pool.Expire(50), 1);
+    BOOST_CHECK(!pool.exists(tx1.GetHash()));
+    BOOST_CHECK(pool.exists(tx2.GetHash()));
+    BOOST_CHECK_EQUAL(pool.Expire(50), 0);
+
+    SetMockTime(0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
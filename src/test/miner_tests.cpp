@@ -375,6 +375,59 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     delete pblocktemplate;
     mempool.clear();
 
+    // template following the mempool on the same tip
+    BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+    tx.vin[0].prevout.hash = txFirst[0]->GetHash();
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vout[0].nValue = 49000LL;
+    tx.vout[0].scriptPubKey = CScript() << OP_1;
+    hash = tx.GetHash();
+    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 1000, GetTime(), 111.0, 11));
+    tx.vin[0].prevout.hash = hash;
+    tx.vout[0].nValue = 48000LL;
+    uint256 hashChild = tx.GetHash();
+    mempool.addUnchecked(hashChild, CTxMemPoolEntry(tx, 1000, GetTime(), 111.0, 11));
+    BOOST_CHECK(UpdateBlockTemplate(*pblocktemplate));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3);
+    BOOST_CHECK(pblocktemplate->block.vtx[1].GetHash() == hash);
+    BOOST_CHECK(pblocktemplate->block.vtx[2].GetHash() == hashChild);
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -(pblocktemplate->vTxFees[1] + pblocktemplate->vTxFees[2]));
+    {
+        CValidationState state;
+        BOOST_CHECK(TestBlockValidity(state, pblocktemplate->block, chainActive.Tip(), false, false));
+    }
+    // the child leaves the pool along with its parent
+    std::list<CTransaction> removed;
+    mempool.remove(pblocktemplate->block.vtx[1], removed, true);
+    BOOST_CHECK(UpdateBlockTemplate(*pblocktemplate));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], 0);
+    delete pblocktemplate;
+    mempool.clear();
+
+    // a child paying for its free parent gets it mined, ahead of a
+    // transaction paying more than the parent alone
+    tx.vin[0].prevout.hash = txFirst[0]->GetHash();
+    tx.vout[0].nValue = 49000LL;
+    uint256 hashParent = tx.GetHash();
+    mempool.addUnchecked(hashParent, CTxMemPoolEntry(tx, 0, GetTime(), 111.0, 11));
+    tx.vin[0].prevout.hash = hashParent;
+    tx.vout[0].nValue = 48000LL;
+    hashChild = tx.GetHash();
+    mempool.addUnchecked(hashChild, CTxMemPoolEntry(tx, 20000, GetTime(), 111.0, 11));
+    tx.vin[0].prevout.hash = txFirst[1]->GetHash();
+    tx.vout[0].nValue = 39000LL;
+    hash = tx.GetHash();
+    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 5000, GetTime(), 111.0, 11));
+    BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 4);
+    BOOST_CHECK(pblocktemplate->block.vtx[1].GetHash() == hashParent);
+    BOOST_CHECK(pblocktemplate->block.vtx[2].GetHash() == hashChild);
+    BOOST_CHECK(pblocktemplate->block.vtx[3].GetHash() == hash);
+    delete pblocktemplate;
+    mempool.clear();
+
     // subsidy changing
     int nHeight = chainActive.Height();
     chainActive.Tip()->nHeight = 209999;
@@ -2,6 +2,8 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "chainparams.h"
+#include "crypto/equihash.h"
 #include "main.h"
 #include "pow.h"
 #include "util.h"
@@ -93,4 +95,67 @@ BOOST_AUTO_TEST_CASE(GetBlockProofEquivalentTime_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(check_equihash_solution)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    const CChainParams& params = Params();
+    size_t cBitLen = params.EquihashN()/(params.EquihashK()+1);
+
+    CBlockHeader header = params.GenesisBlock().GetBlockHeader();
+    BOOST_CHECK(CheckEquihashSolution(&header, params));
+
+    std::vector<eh_index> indices = GetIndicesFromMinimal(header.nSolution, cBitLen);
+    std::vector<unsigned char> solution = header.nSolution;
+
+    // Flip the last bit of the last index
+    header.nSolution.back() ^= 1;
+    BOOST_CHECK(!CheckEquihashSolution(&header, params));
+
+    // Truncated solution
+    header.nSolution = solution;
+    header.nSolution.pop_back();
+    BOOST_CHECK(!CheckEquihashSolution(&header, params));
+
+    // Reverse the first pair of indices
+    std::vector<eh_index> modified = indices;
+    std::swap(modified[0], modified[1]);
+    header.nSolution = GetMinimalFromIndices(modified, cBitLen);
+    BOOST_CHECK(!CheckEquihashSolution(&header, params));
+
+    // Swap the first half and second half
+    modified = indices;
+    std::rotate(modified.begin(), modified.begin() + modified.size()/2, modified.end());
+    header.nSolution = GetMinimalFromIndices(modified, cBitLen);
+    BOOST_CHECK(!CheckEquihashSolution(&header, params));
+
+    // Duplicate first half
+    modified = indices;
+    std::copy(modified.begin(), modified.begin() + modified.size()/2, modified.begin() + modified.size()/2);
+    header.nSolution = GetMinimalFromIndices(modified, cBitLen);
+    BOOST_CHECK(!CheckEquihashSolution(&header, params));
+
+    // A different nonce
+    header.nSolution = solution;
+    header.nNonce = ArithToUint256(UintToArith256(header.nNonce) + 1);
+    BOOST_CHECK(!CheckEquihashSolution(&header, params));
+}
+
+BOOST_AUTO_TEST_CASE(check_block_headers_pow)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    const CChainParams& params = Params();
+
+    std::vector<CBlockHeader> headers(3, params.GenesisBlock().GetBlockHeader());
+    BOOST_CHECK(CheckBlockHeadersPOW(headers));
+    BOOST_CHECK(CheckBlockHeadersPOW(std::vector<CBlockHeader>()));
+
+    // Any invalid header fails the whole batch
+    headers[1].nSolution.back() ^= 1;
+    BOOST_CHECK(!CheckBlockHeadersPOW(headers));
+
+    headers[1] = headers[0];
+    headers[2].nBits = UintToArith256(uint256S("0x0000000000000000000000000000000000000000000000000000000000000001")).GetCompact();
+    BOOST_CHECK(!CheckBlockHeadersPOW(headers));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -418,6 +418,8 @@ BOOST_AUTO_TEST_CASE(test_simple_joinsplit_invalidity)
 
         BOOST_CHECK(!CheckTransactionWithoutProofVerification(newTx, state));
         BOOST_CHECK(state.GetRejectReason() == "bad-txns-invalid-joinsplit-signature");
+        BOOST_CHECK(!PreCheckTransaction(newTx, state));
+        BOOST_CHECK(state.GetRejectReason() == "bad-txns-invalid-joinsplit-signature");
 
         // Empty output script.
         CScript scriptCode;
@@ -430,6 +432,10 @@ BOOST_AUTO_TEST_CASE(test_simple_joinsplit_invalidity)
                                     ) == 0);
 
         BOOST_CHECK(CheckTransactionWithoutProofVerification(newTx, state));
+
+        // The signature is fine now, but the proof isn't
+        BOOST_CHECK(!PreCheckTransaction(newTx, state));
+        BOOST_CHECK(state.GetRejectReason() == "bad-txns-joinsplit-verification-failed");
     }
     {
         // Ensure that values within the joinsplit are well-formed.
@@ -6,34 +6,179 @@
 #ifndef BITCOIN_TXDB_H
 #define BITCOIN_TXDB_H
 
+#include "bloom.h"
 #include "coins.h"
+#include "coinstats.h"
 #include "leveldbwrapper.h"
+#include "sync.h"
 
+#include <boost/optional.hpp>
+#include <boost/thread.hpp>
+
+#include <atomic>
+#include <ios>
+#include <list>
 #include <map>
+#include <string.h>
 #include <string>
 #include <utility>
 #include <vector>
 
+class CAutoFile;
 class CBlockFileInfo;
 class CBlockIndex;
+class CDiskBlockIndex;
 struct CDiskTxPos;
 class uint256;
+template<typename Source> class CHashVerifier;
 
 //! -dbcache default (MiB)
 static const int64_t nDefaultDbCache = 450;
 //! max. -dbcache (MiB)
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
+//! Trees of pruned anchors kept after being recomputed
+static const size_t MAX_RECOMPUTED_ANCHORS = 16;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! Minimum number of nullifiers the nullifier filter is sized for
+static const unsigned int NULLIFIER_FILTER_MIN_ELEMENTS = 1000000;
+
+struct CCoinsWriteStats
+{
+    uint64_t nWrites;        //!< Number of batches written to the database
+    int64_t nLastDuration;   //!< Time taken to write the last batch (ms)
+    uint64_t nLastBytes;     //!< Approximate size of the last batch
+    uint64_t nTotalBytes;    //!< Approximate size of all batches written
+    bool fPending;           //!< Whether a batch is being written in the background
+
+    CCoinsWriteStats() : nWrites(0), nLastDuration(0), nLastBytes(0), nTotalBytes(0), fPending(false) {}
+};
+
+/** Header of a chainstate snapshot file, as written by dumptxoutset */
+struct CCoinsSnapshotMetadata
+{
+    static const uint32_t CURRENT_VERSION = 1;
+
+    uint32_t nVersion;
+    uint256 hashBlock;          //!< Block the snapshot was taken at
+    uint256 hashAnchor;         //!< Best anchor at that block
+    int nHeight;
+    unsigned int nChainTx;      //!< Number of transactions up to and including the block
+    boost::optional<CAmount> nChainSproutValue;
+    uint256 hashUTXOSet;        //!< MuHash of the UTXO set at the block (see gettxoutsetinfo)
+
+    CCoinsSnapshotMetadata() : nVersion(CURRENT_VERSION), nHeight(0), nChainTx(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersionIn) {
+        unsigned char pchMagic[4] = {'s', 'g', 'u', 't'};
+        READWRITE(FLATDATA(pchMagic));
+        if (ser_action.ForRead() && memcmp(pchMagic, "sgut", sizeof(pchMagic)) != 0)
+            throw std::ios_base::failure("not a chainstate snapshot");
+        READWRITE(nVersion);
+        if (ser_action.ForRead() && nVersion > CURRENT_VERSION)
+            throw std::ios_base::failure("unsupported chainstate snapshot version");
+        READWRITE(hashBlock);
+        READWRITE(hashAnchor);
+        READWRITE(nHeight);
+        READWRITE(nChainTx);
+        READWRITE(nChainSproutValue);
+        READWRITE(hashUTXOSet);
+    }
+};
+
+/** Anchors whose note commitment trees are dropped from the database, see -anchorhistory */
+struct CAnchorPruning
+{
+    std::vector<std::pair<uint256, int> > vAnchors;     //!< Root and height of the block that created it
+    int nHeight;                                        //!< Height up to which anchors were considered
+
+    CAnchorPruning() : nHeight(0) {}
+};
+
+struct CAnchorStats
+{
+    uint64_t nAnchors;       //!< Anchors with their note commitment tree stored
+    uint64_t nAnchorBytes;
+    uint64_t nPruned;        //!< Anchors whose tree is recomputed from blocks when needed
+    uint64_t nPrunedBytes;
+    int nPrunedHeight;
+
+    CAnchorStats() : nAnchors(0), nAnchorBytes(0), nPruned(0), nPrunedBytes(0), nPrunedHeight(0) {}
+};
+
+struct CCoinsSnapshotCounts
+{
+    uint64_t nCoins;        //!< Transactions with unspent outputs
+    uint64_t nNullifiers;
+    uint64_t nAnchors;
+
+    CCoinsSnapshotCounts() : nCoins(0), nNullifiers(0), nAnchors(0) {}
+};
 
 /** CCoinsView backed by the LevelDB coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CLevelDBWrapper db;
+
+    /**
+     * Filter over the nullifiers in the database. Almost all nullifier lookups
+     * are for unspent nullifiers, and those can mostly be answered without
+     * reading the database.
+     */
+    CBlockedBloomFilter nullifierFilter;
+    mutable CCriticalSection cs_nullifierFilter;
+
+    /**
+     * Entries passed to the last BatchWrite, while the background writer
+     * thread writes them to the database. Lookups are answered from them
+     * first, so that callers see the state of the last BatchWrite.
+     */
+    CCoinsMap pendingCoins;
+    CAnchorsMap pendingAnchors;
+    CNullifiersMap pendingNullifiers;
+    uint256 pendingBestBlock;
+    uint256 pendingBestAnchor;
+    boost::optional<CUTXOStats> pendingUTXOStats;
+    boost::optional<CAnchorPruning> pendingAnchorPruning;
+    CCoinsWriteStats writeStats;
+    mutable boost::shared_mutex cs_pending;
+
+    /**
+     * Trees of pruned anchors recomputed lately, most recently used first.
+     * Transactions spending from the same old anchor would otherwise replay
+     * the same blocks each time. A root commits to its tree, so they never
+     * go stale.
+     */
+    mutable std::list<std::pair<uint256, ZCIncrementalMerkleTree> > recomputedAnchors;
+    mutable CCriticalSection cs_recomputedAnchors;
+
+    //! Guards the writer thread
+    mutable boost::mutex cs_writer;
+    boost::thread writer;
+    bool fAsyncWrite;
+    std::atomic<bool> fWriteFailed;
+    //! UTXO set statistics to write along with the next batch (guarded by cs_writer)
+    boost::optional<CUTXOStats> nextUTXOStats;
+    //! Anchors to prune along with the next batch (guarded by cs_writer)
+    boost::optional<CAnchorPruning> nextAnchorPruning;
+
     CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    //! Load the snapshot of the nullifier filter, or rebuild it if outdated
+    void LoadNullifierFilter();
+    //! Body of the writer thread
+    void WritePending();
+    //! Erase the entries of a snapshot whose loading was interrupted
+    void DiscardPartialSnapshot();
+    //! Erase all coins, nullifiers and anchors
+    bool EraseChainstate();
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CCoinsViewDB();
 
     bool GetAnchorAt(const uint256 &rt, ZCIncrementalMerkleTree &tree) const;
     bool GetNullifier(const uint256 &nf) const;
@@ -47,6 +192,65 @@ public:
                     CAnchorsMap &mapAnchors,
                     CNullifiersMap &mapNullifiers);
     bool GetStats(CCoinsStats &stats) const;
+
+    /**
+     * Convert the coins stored per transaction by older versions to one entry
+     * per output. Safe to interrupt; the conversion resumes at next startup.
+     */
+    bool Upgrade();
+
+    //! Read the UTXO set statistics last written; check their hashBlock before using them
+    bool ReadUTXOStats(CUTXOStats &stats) const;
+    /**
+     * Write stats along with the next batch, which makes them consistent
+     * with the coins whenever stats.hashBlock equals the best block.
+     */
+    void SetUTXOStats(const CUTXOStats &stats);
+    //! Compute the UTXO set statistics by scanning the whole database
+    bool ComputeUTXOStats(CUTXOStats &stats) const;
+
+    //! Like GetAnchorAt, but only for anchors whose tree is stored
+    bool ReadAnchor(const uint256 &rt, ZCIncrementalMerkleTree &tree) const;
+    /**
+     * Replace the trees of the given anchors by their height along with the
+     * next batch. GetAnchorAt then recomputes them from the blocks.
+     */
+    void SetAnchorPruning(const CAnchorPruning &pruning);
+    //! Height up to which anchors have been considered for pruning
+    int GetAnchorsPrunedHeight() const;
+    bool GetAnchorStats(CAnchorStats &stats) const;
+
+    /**
+     * Write the coins, nullifiers and anchors to file, followed by a
+     * checksum. The database is read as it is when this is called, which
+     * must be at metadata.hashBlock (metadata.hashAnchor is filled in).
+     */
+    bool DumpSnapshot(CAutoFile &file, CCoinsSnapshotMetadata &metadata, CCoinsSnapshotCounts &counts) const;
+    /**
+     * Add the coins, nullifiers and anchors of a snapshot file, read up to
+     * the checksum, to the database, which must not have any yet. They are
+     * only used once FinishSnapshot() commits them, and discarded at the next
+     * startup if that never happens. stats are computed along the way.
+     */
+    bool LoadSnapshot(CHashVerifier<CAutoFile> &file, CUTXOStats &stats, CCoinsSnapshotCounts &counts);
+    //! Make the entries added by LoadSnapshot() the chainstate at metadata.hashBlock, or discard them
+    bool FinishSnapshot(const CCoinsSnapshotMetadata &metadata, const CUTXOStats &stats, bool fCommit);
+
+    //! Save a snapshot of the nullifier filter, so it needn't be rebuilt at next startup
+    bool WriteNullifierFilter();
+
+    /**
+     * Make BatchWrite return as soon as it has taken over the entries to
+     * write, and write them on a background thread. A crash before the write
+     * completes leaves the database at the previous best block, as if
+     * BatchWrite hadn't been called.
+     */
+    void SetAsyncWrite(bool fAsync);
+    //! Wait until the last batch is in the database. Returns false if writing it failed.
+    bool WaitForWrite();
+    //! Whether writing a batch in the background failed
+    bool HasWriteFailed() const;
+    CCoinsWriteStats GetWriteStats() const;
 };
 
 /** Access to the block database (blocks/index/) */
@@ -60,6 +264,7 @@ private:
 public:
     bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &fileinfo);
+    bool ReadDiskBlockIndex(const uint256 &blockhash, CDiskBlockIndex &dbindex);
     bool ReadLastBlockFile(int &nFile);
     bool WriteReindexing(bool fReindex);
     bool ReadReindexing(bool &fReindex);
@@ -68,6 +273,9 @@ public:
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts();
+    //! The snapshot the chainstate was loaded from, if any (see loadtxoutset)
+    bool WriteSnapshotBase(const CCoinsSnapshotMetadata &metadata);
+    bool ReadSnapshotBase(CCoinsSnapshotMetadata &metadata);
 };
 
 #endif // BITCOIN_TXDB_H
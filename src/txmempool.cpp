@@ -15,10 +15,16 @@
 #include "utilmoneystr.h"
 #include "version.h"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 using namespace std;
 
 CTxMemPoolEntry::CTxMemPoolEntry():
-    nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0), hadNoDependencies(false)
+    nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0), hadNoDependencies(false), feeDelta(0),
+    nCountWithDescendants(1), nSizeWithDescendants(0), nModFeesWithDescendants(0),
+    nCountWithAncestors(1), nSizeWithAncestors(0), nModFeesWithAncestors(0)
 {
     nHeight = MEMPOOL_HEIGHT;
 }
@@ -27,11 +33,18 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
                                  int64_t _nTime, double _dPriority,
                                  unsigned int _nHeight, bool poolHasNoInputsOf):
     tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight),
-    hadNoDependencies(poolHasNoInputsOf)
+    hadNoDependencies(poolHasNoInputsOf), feeDelta(0)
 {
     nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
     nModSize = tx.CalculateModifiedSize(nTxSize);
     nUsageSize = RecursiveDynamicUsage(tx);
+
+    nCountWithDescendants = 1;
+    nSizeWithDescendants = nTxSize;
+    nModFeesWithDescendants = nFee;
+    nCountWithAncestors = 1;
+    nSizeWithAncestors = nTxSize;
+    nModFeesWithAncestors = nFee;
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
@@ -48,8 +61,34 @@ CTxMemPoolEntry::GetPriority(unsigned int currentHeight) const
     return dResult;
 }
 
+void CTxMemPoolEntry::UpdateFeeDelta(CAmount newFeeDelta)
+{
+    nModFeesWithDescendants += newFeeDelta - feeDelta;
+    nModFeesWithAncestors += newFeeDelta - feeDelta;
+    feeDelta = newFeeDelta;
+}
+
+void CTxMemPoolEntry::UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount)
+{
+    nSizeWithDescendants += modifySize;
+    assert(int64_t(nSizeWithDescendants) > 0);
+    nModFeesWithDescendants += modifyFee;
+    nCountWithDescendants += modifyCount;
+    assert(int64_t(nCountWithDescendants) > 0);
+}
+
+void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount)
+{
+    nSizeWithAncestors += modifySize;
+    assert(int64_t(nSizeWithAncestors) > 0);
+    nModFeesWithAncestors += modifyFee;
+    nCountWithAncestors += modifyCount;
+    assert(int64_t(nCountWithAncestors) > 0);
+}
+
 CTxMemPool::CTxMemPool(const CFeeRate& _minRelayFee) :
-    nTransactionsUpdated(0)
+    nTransactionsUpdated(0), cachedInnerUsage(0), lastRollingFeeUpdate(GetTime()),
+    blockSinceLastRollingFeeBump(false), rollingMinimumFeeRate(0)
 {
     // Sanity checks off by default for performance, because otherwise
     // accepting transactions becomes O(N^2) where N is the number
@@ -96,8 +135,12 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     // Used by main.cpp AcceptToMemoryPool(), which DOES do
     // all the appropriate checks.
     LOCK(cs);
-    mapTx[hash] = entry;
-    const CTransaction& tx = mapTx[hash].GetTx();
+    txiter newit = mapTx.insert(entry).first;
+    // Apply a fee delta the transaction was given before it arrived
+    std::map<uint256, std::pair<double, CAmount> >::const_iterator pos = mapDeltas.find(hash);
+    if (pos != mapDeltas.end() && pos->second.second != 0)
+        mapTx.modify(newit, update_fee_delta(pos->second.second));
+    const CTransaction& tx = newit->GetTx();
     for (unsigned int i = 0; i < tx.vin.size(); i++)
         mapNextTx[tx.vin[i].prevout] = CInPoint(&tx, i);
     BOOST_FOREACH(const JSDescription &joinsplit, tx.vjoinsplit) {
@@ -105,6 +148,8 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
             mapNullifiers[nf] = &tx;
         }
     }
+    LinkEntry(newit);
+    UpdateForAdd(newit);
     nTransactionsUpdated++;
     totalTxSize += entry.GetTxSize();
     cachedInnerUsage += entry.DynamicMemoryUsage();
@@ -113,6 +158,122 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     return true;
 }
 
+void CTxMemPool::AddLink(const CTxMemPoolEntry& parent, const CTxMemPoolEntry& child)
+{
+    if (parent.setChildren.insert(&child).second)
+        cachedInnerUsage += memusage::IncrementalDynamicUsage(parent.setChildren);
+    if (child.setParents.insert(&parent).second)
+        cachedInnerUsage += memusage::IncrementalDynamicUsage(child.setParents);
+}
+
+void CTxMemPool::LinkEntry(txiter it)
+{
+    const CTransaction& tx = it->GetTx();
+    BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+        txiter parent = mapTx.find(txin.prevout.hash);
+        if (parent != mapTx.end())
+            AddLink(*parent, *it);
+    }
+    // The transactions of a disconnected block come back after the ones
+    // spending them
+    const uint256& hash = tx.GetHash();
+    std::map<COutPoint, CInPoint>::const_iterator next = mapNextTx.lower_bound(COutPoint(hash, 0));
+    for (; next != mapNextTx.end() && next->first.hash == hash; next++) {
+        txiter child = mapTx.find(next->second.ptx->GetHash());
+        assert(child != mapTx.end());
+        AddLink(*it, *child);
+    }
+}
+
+void CTxMemPool::UpdateForAdd(txiter it)
+{
+    CTxMemPoolEntry::Links setAncestors, setDescendants;
+    std::string dummy;
+    CalculateMemPoolAncestors(*it, setAncestors, std::numeric_limits<uint64_t>::max(), std::numeric_limits<uint64_t>::max(),
+                              std::numeric_limits<uint64_t>::max(), std::numeric_limits<uint64_t>::max(), dummy, false);
+    CalculateDescendants(*it, setDescendants);
+
+    if (setDescendants.empty()) {
+        // The usual case: the transaction joins the packages of its ancestors
+        int64_t nSizeAncestors = 0;
+        CAmount nFeesAncestors = 0;
+        BOOST_FOREACH(const CTxMemPoolEntry* pancestor, setAncestors) {
+            mapTx.modify(mapTx.iterator_to(*pancestor), update_descendant_state(it->GetTxSize(), it->GetModifiedFee(), 1));
+            nSizeAncestors += pancestor->GetTxSize();
+            nFeesAncestors += pancestor->GetModifiedFee();
+        }
+        mapTx.modify(it, update_ancestor_state(nSizeAncestors, nFeesAncestors, setAncestors.size()));
+        return;
+    }
+
+    // A transaction of a disconnected block comes back after the ones
+    // spending it, which gain its ancestors along with it. As packages may
+    // overlap, count them again.
+    RecomputePackageState(it);
+    BOOST_FOREACH(const CTxMemPoolEntry* pancestor, setAncestors)
+        RecomputePackageState(mapTx.iterator_to(*pancestor));
+    BOOST_FOREACH(const CTxMemPoolEntry* pdescendant, setDescendants)
+        RecomputePackageState(mapTx.iterator_to(*pdescendant));
+}
+
+void CTxMemPool::RecomputePackageState(txiter it)
+{
+    CTxMemPoolEntry::Links setAncestors, setDescendants;
+    std::string dummy;
+    CalculateMemPoolAncestors(*it, setAncestors, std::numeric_limits<uint64_t>::max(), std::numeric_limits<uint64_t>::max(),
+                              std::numeric_limits<uint64_t>::max(), std::numeric_limits<uint64_t>::max(), dummy, false);
+    CalculateDescendants(*it, setDescendants);
+
+    int64_t nSize = it->GetTxSize();
+    CAmount nFees = it->GetModifiedFee();
+    BOOST_FOREACH(const CTxMemPoolEntry* pancestor, setAncestors) {
+        nSize += pancestor->GetTxSize();
+        nFees += pancestor->GetModifiedFee();
+    }
+    mapTx.modify(it, update_ancestor_state(nSize - it->GetSizeWithAncestors(), nFees - it->GetModFeesWithAncestors(),
+                                           (int64_t)setAncestors.size() + 1 - it->GetCountWithAncestors()));
+
+    nSize = it->GetTxSize();
+    nFees = it->GetModifiedFee();
+    BOOST_FOREACH(const CTxMemPoolEntry* pdescendant, setDescendants) {
+        nSize += pdescendant->GetTxSize();
+        nFees += pdescendant->GetModifiedFee();
+    }
+    mapTx.modify(it, update_descendant_state(nSize - it->GetSizeWithDescendants(), nFees - it->GetModFeesWithDescendants(),
+                                             (int64_t)setDescendants.size() + 1 - it->GetCountWithDescendants()));
+}
+
+void CTxMemPool::UpdateForRemove(txiter it, bool fUpdateDescendants)
+{
+    CTxMemPoolEntry::Links setAncestors;
+    std::string dummy;
+    CalculateMemPoolAncestors(*it, setAncestors, std::numeric_limits<uint64_t>::max(), std::numeric_limits<uint64_t>::max(),
+                              std::numeric_limits<uint64_t>::max(), std::numeric_limits<uint64_t>::max(), dummy, false);
+    BOOST_FOREACH(const CTxMemPoolEntry* pancestor, setAncestors)
+        mapTx.modify(mapTx.iterator_to(*pancestor), update_descendant_state(-(int64_t)it->GetTxSize(), -it->GetModifiedFee(), -1));
+
+    if (fUpdateDescendants) {
+        CTxMemPoolEntry::Links setDescendants;
+        CalculateDescendants(*it, setDescendants);
+        BOOST_FOREACH(const CTxMemPoolEntry* pdescendant, setDescendants)
+            mapTx.modify(mapTx.iterator_to(*pdescendant), update_ancestor_state(-(int64_t)it->GetTxSize(), -it->GetModifiedFee(), -1));
+    }
+}
+
+void CTxMemPool::UnlinkEntry(txiter it)
+{
+    BOOST_FOREACH(const CTxMemPoolEntry* parent, it->setParents) {
+        parent->setChildren.erase(&*it);
+        cachedInnerUsage -= memusage::IncrementalDynamicUsage(parent->setChildren);
+    }
+    BOOST_FOREACH(const CTxMemPoolEntry* child, it->setChildren) {
+        child->setParents.erase(&*it);
+        cachedInnerUsage -= memusage::IncrementalDynamicUsage(child->setParents);
+    }
+    cachedInnerUsage -= memusage::DynamicUsage(it->setParents) + memusage::DynamicUsage(it->setChildren);
+    it->setParents.clear();
+    it->setChildren.clear();
+}
 
 void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& removed, bool fRecursive)
 {
@@ -133,21 +294,36 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
                 txToRemove.push_back(it->second.ptx->GetHash());
             }
         }
+        std::vector<txiter> vRemove;
+        std::set<uint256> setRemove;
         while (!txToRemove.empty())
         {
             uint256 hash = txToRemove.front();
             txToRemove.pop_front();
-            if (!mapTx.count(hash))
+            txiter it = mapTx.find(hash);
+            if (it == mapTx.end() || !setRemove.insert(hash).second)
                 continue;
-            const CTransaction& tx = mapTx[hash].GetTx();
+            vRemove.push_back(it);
             if (fRecursive) {
-                for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                    std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(hash, i));
-                    if (it == mapNextTx.end())
+                for (unsigned int i = 0; i < it->GetTx().vout.size(); i++) {
+                    std::map<COutPoint, CInPoint>::iterator iter = mapNextTx.find(COutPoint(hash, i));
+                    if (iter == mapNextTx.end())
                         continue;
-                    txToRemove.push_back(it->second.ptx->GetHash());
+                    txToRemove.push_back(iter->second.ptx->GetHash());
                 }
             }
+        }
+
+        // Take the transactions out of the packages of those that stay,
+        // while the links still tell whose packages they are in. When
+        // removing recursively, the descendants all go too.
+        BOOST_FOREACH(txiter it, vRemove)
+            UpdateForRemove(it, !fRecursive);
+
+        BOOST_FOREACH(txiter it, vRemove)
+        {
+            const uint256 hash = it->GetTx().GetHash();
+            const CTransaction& tx = it->GetTx();
             BOOST_FOREACH(const CTxIn& txin, tx.vin)
                 mapNextTx.erase(txin.prevout);
             BOOST_FOREACH(const JSDescription& joinsplit, tx.vjoinsplit) {
@@ -157,9 +333,10 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
             }
 
             removed.push_back(tx);
-            totalTxSize -= mapTx[hash].GetTxSize();
-            cachedInnerUsage -= mapTx[hash].DynamicMemoryUsage();
-            mapTx.erase(hash);
+            totalTxSize -= it->GetTxSize();
+            cachedInnerUsage -= it->DynamicMemoryUsage();
+            UnlinkEntry(it);
+            mapTx.erase(it);
             nTransactionsUpdated++;
             minerPolicyEstimator->removeTx(hash);
         }
@@ -171,11 +348,10 @@ void CTxMemPool::removeCoinbaseSpends(const CCoinsViewCache *pcoins, unsigned in
     // Remove transactions spending a coinbase which are now immature
     LOCK(cs);
     list<CTransaction> transactionsToRemove;
-    for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
-        const CTransaction& tx = it->second.GetTx();
+    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
+        const CTransaction& tx = it->GetTx();
         BOOST_FOREACH(const CTxIn& txin, tx.vin) {
-            std::map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(txin.prevout.hash);
-            if (it2 != mapTx.end())
+            if (mapTx.count(txin.prevout.hash))
                 continue;
             const CCoins *coins = pcoins->AccessCoins(txin.prevout.hash);
             if (fSanityCheck) assert(coins);
@@ -201,8 +377,8 @@ void CTxMemPool::removeWithAnchor(const uint256 &invalidRoot)
     LOCK(cs);
     list<CTransaction> transactionsToRemove;
 
-    for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
-        const CTransaction& tx = it->second.GetTx();
+    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
+        const CTransaction& tx = it->GetTx();
         BOOST_FOREACH(const JSDescription& joinsplit, tx.vjoinsplit) {
             if (joinsplit.anchor == invalidRoot) {
                 transactionsToRemove.push_back(tx);
@@ -257,9 +433,9 @@ void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned i
     std::vector<CTxMemPoolEntry> entries;
     BOOST_FOREACH(const CTransaction& tx, vtx)
     {
-        uint256 hash = tx.GetHash();
-        if (mapTx.count(hash))
-            entries.push_back(mapTx[hash]);
+        indexed_transaction_set::const_iterator it = mapTx.find(tx.GetHash());
+        if (it != mapTx.end())
+            entries.push_back(*it);
     }
     BOOST_FOREACH(const CTransaction& tx, vtx)
     {
@@ -270,6 +446,8 @@ void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned i
     }
     // After the txs in the new block have been removed from the mempool, update policy estimates
     minerPolicyEstimator->processBlock(nBlockHeight, entries, fCurrentEstimate);
+    lastRollingFeeUpdate = GetTime();
+    blockSinceLastRollingFeeBump = true;
 }
 
 void CTxMemPool::clear()
@@ -279,6 +457,9 @@ void CTxMemPool::clear()
     mapNextTx.clear();
     totalTxSize = 0;
     cachedInnerUsage = 0;
+    lastRollingFeeUpdate = GetTime();
+    blockSinceLastRollingFeeBump = false;
+    rollingMinimumFeeRate = 0;
     ++nTransactionsUpdated;
 }
 
@@ -296,19 +477,21 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
 
     LOCK(cs);
     list<const CTxMemPoolEntry*> waitingOnDependants;
-    for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
+    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
         unsigned int i = 0;
-        checkTotal += it->second.GetTxSize();
-        innerUsage += it->second.DynamicMemoryUsage();
-        const CTransaction& tx = it->second.GetTx();
+        checkTotal += it->GetTxSize();
+        innerUsage += it->DynamicMemoryUsage() + memusage::DynamicUsage(it->GetMemPoolParents()) + memusage::DynamicUsage(it->GetMemPoolChildren());
+        const CTransaction& tx = it->GetTx();
         bool fDependsWait = false;
+        CTxMemPoolEntry::Links setParentCheck;
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
             // Check that every mempool transaction's inputs refer to available coins, or other mempool tx's.
-            std::map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(txin.prevout.hash);
+            indexed_transaction_set::const_iterator it2 = mapTx.find(txin.prevout.hash);
             if (it2 != mapTx.end()) {
-                const CTransaction& tx2 = it2->second.GetTx();
+                const CTransaction& tx2 = it2->GetTx();
                 assert(tx2.vout.size() > txin.prevout.n && !tx2.vout[txin.prevout.n].IsNull());
                 fDependsWait = true;
+                setParentCheck.insert(&*it2);
             } else {
                 const CCoins* coins = pcoins->AccessCoins(txin.prevout.hash);
                 assert(coins && coins->IsAvailable(txin.prevout.n));
@@ -320,6 +503,41 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             assert(it3->second.n == i);
             i++;
         }
+        assert(setParentCheck == it->GetMemPoolParents());
+        // Check that the children are the transactions spending its outputs
+        CTxMemPoolEntry::Links setChildrenCheck;
+        std::map<COutPoint, CInPoint>::const_iterator iter = mapNextTx.lower_bound(COutPoint(tx.GetHash(), 0));
+        for (; iter != mapNextTx.end() && iter->first.hash == tx.GetHash(); iter++) {
+            indexed_transaction_set::const_iterator childit = mapTx.find(iter->second.ptx->GetHash());
+            assert(childit != mapTx.end());
+            setChildrenCheck.insert(&*childit);
+        }
+        assert(setChildrenCheck == it->GetMemPoolChildren());
+
+        // Check the package state against the links
+        CTxMemPoolEntry::Links setAncestors, setDescendants;
+        std::string dummy;
+        CalculateMemPoolAncestors(*it, setAncestors, std::numeric_limits<uint64_t>::max(), std::numeric_limits<uint64_t>::max(),
+                                  std::numeric_limits<uint64_t>::max(), std::numeric_limits<uint64_t>::max(), dummy, false);
+        CalculateDescendants(*it, setDescendants);
+        uint64_t nSizeCheck = it->GetTxSize();
+        CAmount nFeesCheck = it->GetModifiedFee();
+        BOOST_FOREACH(const CTxMemPoolEntry* pancestor, setAncestors) {
+            nSizeCheck += pancestor->GetTxSize();
+            nFeesCheck += pancestor->GetModifiedFee();
+        }
+        assert(it->GetCountWithAncestors() == setAncestors.size() + 1);
+        assert(it->GetSizeWithAncestors() == nSizeCheck);
+        assert(it->GetModFeesWithAncestors() == nFeesCheck);
+        nSizeCheck = it->GetTxSize();
+        nFeesCheck = it->GetModifiedFee();
+        BOOST_FOREACH(const CTxMemPoolEntry* pdescendant, setDescendants) {
+            nSizeCheck += pdescendant->GetTxSize();
+            nFeesCheck += pdescendant->GetModifiedFee();
+        }
+        assert(it->GetCountWithDescendants() == setDescendants.size() + 1);
+        assert(it->GetSizeWithDescendants() == nSizeCheck);
+        assert(it->GetModFeesWithDescendants() == nFeesCheck);
 
         boost::unordered_map<uint256, ZCIncrementalMerkleTree, CCoinsKeyHasher> intermediates;
 
@@ -344,7 +562,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             intermediates.insert(std::make_pair(tree.root(), tree));
         }
         if (fDependsWait)
-            waitingOnDependants.push_back(&it->second);
+            waitingOnDependants.push_back(&*it);
         else {
             CValidationState state;
             assert(ContextualCheckInputs(tx, state, mempoolDuplicate, false, 0, false, Params().GetConsensus(), NULL));
@@ -368,9 +586,9 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
     }
     for (std::map<COutPoint, CInPoint>::const_iterator it = mapNextTx.begin(); it != mapNextTx.end(); it++) {
         uint256 hash = it->second.ptx->GetHash();
-        map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(hash);
-        const CTransaction& tx = it2->second.GetTx();
+        indexed_transaction_set::const_iterator it2 = mapTx.find(hash);
         assert(it2 != mapTx.end());
+        const CTransaction& tx = it2->GetTx();
         assert(&tx == it->second.ptx);
         assert(tx.vin.size() > it->second.n);
         assert(it->first == it->second.ptx->vin[it->second.n].prevout);
@@ -378,9 +596,9 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
 
     for (std::map<uint256, const CTransaction*>::const_iterator it = mapNullifiers.begin(); it != mapNullifiers.end(); it++) {
         uint256 hash = it->second->GetHash();
-        map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(hash);
-        const CTransaction& tx = it2->second.GetTx();
+        indexed_transaction_set::const_iterator it2 = mapTx.find(hash);
         assert(it2 != mapTx.end());
+        const CTransaction& tx = it2->GetTx();
         assert(&tx == it->second);
     }
 
@@ -394,16 +612,27 @@ void CTxMemPool::queryHashes(vector<uint256>& vtxid)
 
     LOCK(cs);
     vtxid.reserve(mapTx.size());
-    for (map<uint256, CTxMemPoolEntry>::iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi)
-        vtxid.push_back((*mi).first);
+    for (indexed_transaction_set::iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi)
+        vtxid.push_back(mi->GetTx().GetHash());
+}
+
+void CTxMemPool::queryAnchors(std::set<uint256>& setAnchors)
+{
+    setAnchors.clear();
+
+    LOCK(cs);
+    for (indexed_transaction_set::iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi) {
+        BOOST_FOREACH(const JSDescription& joinsplit, mi->GetTx().vjoinsplit)
+            setAnchors.insert(joinsplit.anchor);
+    }
 }
 
 bool CTxMemPool::lookup(uint256 hash, CTransaction& result) const
 {
     LOCK(cs);
-    map<uint256, CTxMemPoolEntry>::const_iterator i = mapTx.find(hash);
+    indexed_transaction_set::const_iterator i = mapTx.find(hash);
     if (i == mapTx.end()) return false;
-    result = i->second.GetTx();
+    result = i->GetTx();
     return true;
 }
 
@@ -460,6 +689,20 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash,
         std::pair<double, CAmount> &deltas = mapDeltas[hash];
         deltas.first += dPriorityDelta;
         deltas.second += nFeeDelta;
+        txiter it = mapTx.find(hash);
+        if (it != mapTx.end()) {
+            mapTx.modify(it, update_fee_delta(deltas.second));
+            // The fees of the packages the transaction is in change with it
+            CTxMemPoolEntry::Links setAncestors, setDescendants;
+            std::string dummy;
+            CalculateMemPoolAncestors(*it, setAncestors, std::numeric_limits<uint64_t>::max(), std::numeric_limits<uint64_t>::max(),
+                                      std::numeric_limits<uint64_t>::max(), std::numeric_limits<uint64_t>::max(), dummy, false);
+            BOOST_FOREACH(const CTxMemPoolEntry* pancestor, setAncestors)
+                mapTx.modify(mapTx.iterator_to(*pancestor), update_descendant_state(0, nFeeDelta, 0));
+            CalculateDescendants(*it, setDescendants);
+            BOOST_FOREACH(const CTxMemPoolEntry* pdescendant, setDescendants)
+                mapTx.modify(mapTx.iterator_to(*pdescendant), update_ancestor_state(0, nFeeDelta, 0));
+        }
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", strHash, dPriorityDelta, FormatMoney(nFeeDelta));
 }
@@ -516,5 +759,153 @@ bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) const {
 
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
-    return memusage::DynamicUsage(mapTx) + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + cachedInnerUsage;
+    // Estimate the overhead of mapTx to be 11 pointers per entry (3 for each
+    // ordered index, 2 for the hashed one) plus the bucket array.
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 11 * sizeof(void*)) * mapTx.size() +
+           memusage::MallocUsage(sizeof(void*) * mapTx.bucket_count()) +
+           memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapNullifiers) +
+           memusage::DynamicUsage(mapDeltas) + cachedInnerUsage;
+}
+
+bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry& entry, CTxMemPoolEntry::Links& setAncestors,
+                                           uint64_t limitAncestorCount, uint64_t limitAncestorSize,
+                                           uint64_t limitDescendantCount, uint64_t limitDescendantSize,
+                                           std::string& errString, bool fSearchForParents) const
+{
+    LOCK(cs);
+    CTxMemPoolEntry::Links setStage;
+    const CTransaction& tx = entry.GetTx();
+    if (fSearchForParents) {
+        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+            indexed_transaction_set::const_iterator piter = mapTx.find(txin.prevout.hash);
+            if (piter == mapTx.end())
+                continue;
+            setStage.insert(&*piter);
+            if (setStage.size() + 1 > limitAncestorCount) {
+                errString = strprintf("too many unconfirmed parents [limit: %u]", limitAncestorCount);
+                return false;
+            }
+        }
+    } else {
+        setStage = entry.GetMemPoolParents();
+    }
+
+    uint64_t totalSizeWithAncestors = entry.GetTxSize();
+    while (!setStage.empty()) {
+        const CTxMemPoolEntry* pstage = *setStage.begin();
+        setStage.erase(setStage.begin());
+        setAncestors.insert(pstage);
+        totalSizeWithAncestors += pstage->GetTxSize();
+
+        if (pstage->GetSizeWithDescendants() + entry.GetTxSize() > limitDescendantSize) {
+            errString = strprintf("exceeds descendant size limit for tx %s [limit: %u]", pstage->GetTx().GetHash().ToString(), limitDescendantSize);
+            return false;
+        } else if (pstage->GetCountWithDescendants() + 1 > limitDescendantCount) {
+            errString = strprintf("too many descendants for tx %s [limit: %u]", pstage->GetTx().GetHash().ToString(), limitDescendantCount);
+            return false;
+        } else if (totalSizeWithAncestors > limitAncestorSize) {
+            errString = strprintf("exceeds ancestor size limit [limit: %u]", limitAncestorSize);
+            return false;
+        }
+
+        BOOST_FOREACH(const CTxMemPoolEntry* pparent, pstage->GetMemPoolParents()) {
+            if (!setAncestors.count(pparent))
+                setStage.insert(pparent);
+            if (setStage.size() + setAncestors.size() + 1 > limitAncestorCount) {
+                errString = strprintf("too many unconfirmed ancestors [limit: %u]", limitAncestorCount);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void CTxMemPool::CalculateDescendants(const CTxMemPoolEntry& entry, CTxMemPoolEntry::Links& setDescendants) const
+{
+    LOCK(cs);
+    std::vector<const CTxMemPoolEntry*> vStage(1, &entry);
+    while (!vStage.empty()) {
+        const CTxMemPoolEntry* pentry = vStage.back();
+        vStage.pop_back();
+        BOOST_FOREACH(const CTxMemPoolEntry* pchild, pentry->GetMemPoolChildren()) {
+            if (setDescendants.insert(pchild).second)
+                vStage.push_back(pchild);
+        }
+    }
+}
+
+CFeeRate CTxMemPool::GetMinFee(size_t sizelimit) const
+{
+    LOCK(cs);
+    if (!blockSinceLastRollingFeeBump || rollingMinimumFeeRate == 0)
+        return CFeeRate((CAmount)rollingMinimumFeeRate);
+
+    int64_t time = GetTime();
+    if (time > lastRollingFeeUpdate + 10) {
+        // Decay faster when the pool has emptied out
+        double halflife = ROLLING_FEE_HALFLIFE;
+        if (DynamicMemoryUsage() < sizelimit / 4)
+            halflife /= 4;
+        else if (DynamicMemoryUsage() < sizelimit / 2)
+            halflife /= 2;
+
+        rollingMinimumFeeRate = rollingMinimumFeeRate / pow(2.0, (time - lastRollingFeeUpdate) / halflife);
+        lastRollingFeeUpdate = time;
+
+        if (rollingMinimumFeeRate < (double)::minRelayTxFee.GetFeePerK() / 2) {
+            rollingMinimumFeeRate = 0;
+            return CFeeRate(0);
+        }
+    }
+    return std::max(CFeeRate((CAmount)rollingMinimumFeeRate), ::minRelayTxFee);
+}
+
+void CTxMemPool::trackPackageRemoved(const CFeeRate& rate)
+{
+    AssertLockHeld(cs);
+    if (rate.GetFeePerK() > rollingMinimumFeeRate) {
+        rollingMinimumFeeRate = rate.GetFeePerK();
+        blockSinceLastRollingFeeBump = false;
+    }
+}
+
+void CTxMemPool::TrimToSize(size_t sizelimit)
+{
+    LOCK(cs);
+    unsigned int nTxnRemoved = 0;
+    CFeeRate maxFeeRateRemoved(0);
+    while (!mapTx.empty() && DynamicMemoryUsage() > sizelimit) {
+        const CTxMemPoolEntry& entry = *mapTx.get<descendant_score>().begin();
+
+        // Transactions spending from the evicted one go with it, so the fee
+        // rate to beat is that of the whole package. Replacements must pay
+        // for their own relay on top of that.
+        CFeeRate removed(CFeeRate(entry.GetModFeesWithDescendants(), entry.GetSizeWithDescendants()).GetFeePerK() + ::minRelayTxFee.GetFeePerK());
+        trackPackageRemoved(removed);
+        maxFeeRateRemoved = std::max(maxFeeRateRemoved, removed);
+
+        CTransaction tx = entry.GetTx();
+        std::list<CTransaction> removedTxs;
+        remove(tx, removedTxs, true);
+        nTxnRemoved += removedTxs.size();
+    }
+
+    if (maxFeeRateRemoved > CFeeRate(0))
+        LogPrint("mempool", "Removed %u txn, rolling minimum fee bumped to %s\n", nTxnRemoved, maxFeeRateRemoved.ToString());
+}
+
+int CTxMemPool::Expire(int64_t time)
+{
+    LOCK(cs);
+    std::list<CTransaction> transactionsToRemove;
+    typedef indexed_transaction_set::index<entry_time>::type::const_iterator timeiter;
+    for (timeiter it = mapTx.get<entry_time>().begin(); it != mapTx.get<entry_time>().end() && it->GetTime() < time; ++it)
+        transactionsToRemove.push_back(it->GetTx());
+
+    size_t nBefore = mapTx.size();
+    BOOST_FOREACH(const CTransaction& tx, transactionsToRemove) {
+        std::list<CTransaction> removed;
+        remove(tx, removed, true);
+    }
+    return nBefore - mapTx.size();
 }
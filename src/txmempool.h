@@ -7,12 +7,17 @@
 #define BITCOIN_TXMEMPOOL_H
 
 #include <list>
+#include <set>
 
 #include "amount.h"
 #include "coins.h"
 #include "primitives/transaction.h"
 #include "sync.h"
 
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+
 class CAutoFile;
 
 inline double AllowFreeThreshold()
@@ -35,6 +40,9 @@ static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF;
  */
 class CTxMemPoolEntry
 {
+public:
+    typedef std::set<const CTxMemPoolEntry*> Links;
+
 private:
     CTransaction tx;
     CAmount nFee; //! Cached to avoid expensive parent-transaction lookups
@@ -45,6 +53,25 @@ private:
     double dPriority; //! Priority when entering the mempool
     unsigned int nHeight; //! Chain height when entering the mempool
     bool hadNoDependencies; //! Not dependent on any other txs when it entered the mempool
+    CAmount feeDelta; //! Fee delta from PrioritiseTransaction
+
+    //! In-pool transactions this one spends outputs of, and that spend its
+    //! outputs. Maintained by CTxMemPool, and not part of the sort keys.
+    mutable Links setParents;
+    mutable Links setChildren;
+
+    // The in-pool descendants of this transaction, itself included, which
+    // are all removed along with it
+    uint64_t nCountWithDescendants;
+    uint64_t nSizeWithDescendants;
+    CAmount nModFeesWithDescendants;
+
+    // ... and its in-pool ancestors, which must all be mined before it
+    uint64_t nCountWithAncestors;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+
+    friend class CTxMemPool;
 
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
@@ -60,8 +87,137 @@ public:
     unsigned int GetHeight() const { return nHeight; }
     bool WasClearAtEntry() const { return hadNoDependencies; }
     size_t DynamicMemoryUsage() const { return nUsageSize; }
+    //! Fee including the delta given by PrioritiseTransaction, used to mine
+    CAmount GetModifiedFee() const { return nFee + feeDelta; }
+    void UpdateFeeDelta(CAmount newFeeDelta);
+    //! Adjust the package state when transactions join or leave the descendants (ancestors)
+    void UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+    void UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+
+    const Links& GetMemPoolParents() const { return setParents; }
+    const Links& GetMemPoolChildren() const { return setChildren; }
+
+    uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
+    uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
+    CAmount GetModFeesWithDescendants() const { return nModFeesWithDescendants; }
+
+    uint64_t GetCountWithAncestors() const { return nCountWithAncestors; }
+    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
+    CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
 };
 
+// extracts a TxMemPoolEntry's transaction hash
+struct mempoolentry_txid
+{
+    typedef uint256 result_type;
+    result_type operator() (const CTxMemPoolEntry &entry) const
+    {
+        return entry.GetTx().GetHash();
+    }
+};
+
+/**
+ * Sort by the fee rate of the transaction with its descendants, or of the
+ * transaction alone if that is higher, lowest first. Evicting the first
+ * entry, which takes its descendants along, loses the least fees.
+ */
+class CompareTxMemPoolEntryByDescendantScore
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        bool fUseADescendants = UseDescendantScore(a);
+        bool fUseBDescendants = UseDescendantScore(b);
+
+        double aFees = fUseADescendants ? a.GetModFeesWithDescendants() : a.GetModifiedFee();
+        double aSize = fUseADescendants ? a.GetSizeWithDescendants() : a.GetTxSize();
+        double bFees = fUseBDescendants ? b.GetModFeesWithDescendants() : b.GetModifiedFee();
+        double bSize = fUseBDescendants ? b.GetSizeWithDescendants() : b.GetTxSize();
+
+        double f1 = aFees * bSize;
+        double f2 = bFees * aSize;
+        if (f1 == f2)
+            return a.GetTx().GetHash() < b.GetTx().GetHash();
+        return f1 < f2;
+    }
+
+    //! Whether the descendants of a raise its fee rate
+    static bool UseDescendantScore(const CTxMemPoolEntry& a)
+    {
+        double f1 = (double)a.GetModifiedFee() * a.GetSizeWithDescendants();
+        double f2 = (double)a.GetModFeesWithDescendants() * a.GetTxSize();
+        return f2 > f1;
+    }
+};
+
+/**
+ * Sort by the modified fee rate of the transaction with its ancestors,
+ * highest first, in the order packages are mined in
+ */
+class CompareTxMemPoolEntryByAncestorScore
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        double f1 = (double)a.GetModFeesWithAncestors() * b.GetSizeWithAncestors();
+        double f2 = (double)b.GetModFeesWithAncestors() * a.GetSizeWithAncestors();
+        if (f1 == f2)
+            return b.GetTx().GetHash() < a.GetTx().GetHash();
+        return f1 > f2;
+    }
+};
+
+/** Sort by entry time, oldest first */
+class CompareTxMemPoolEntryByEntryTime
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        return a.GetTime() < b.GetTime();
+    }
+};
+
+struct update_fee_delta
+{
+    update_fee_delta(CAmount _feeDelta) : feeDelta(_feeDelta) { }
+
+    void operator() (CTxMemPoolEntry &e) { e.UpdateFeeDelta(feeDelta); }
+
+private:
+    CAmount feeDelta;
+};
+
+struct update_descendant_state
+{
+    update_descendant_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount) :
+        modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount) { }
+
+    void operator() (CTxMemPoolEntry &e) { e.UpdateDescendantState(modifySize, modifyFee, modifyCount); }
+
+private:
+    int64_t modifySize;
+    CAmount modifyFee;
+    int64_t modifyCount;
+};
+
+struct update_ancestor_state
+{
+    update_ancestor_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount) :
+        modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount) { }
+
+    void operator() (CTxMemPoolEntry &e) { e.UpdateAncestorState(modifySize, modifyFee, modifyCount); }
+
+private:
+    int64_t modifySize;
+    CAmount modifyFee;
+    int64_t modifyCount;
+};
+
+// Multi_index tag names
+struct descendant_score {};
+struct ancestor_score {};
+struct entry_time {};
+
 class CBlockPolicyEstimator;
 
 /** An inpoint - a combination of a transaction and an index n into its vin */
@@ -98,13 +254,68 @@ private:
     uint64_t totalTxSize = 0; //! sum of all mempool tx' byte sizes
     uint64_t cachedInnerUsage; //! sum of dynamic memory usage of all the map elements (NOT the maps themselves)
 
+    /**
+     * Fee rate that transactions must pay to enter the pool after it had to
+     * evict transactions to stay within its size limit. It decays back to
+     * zero, but only once a block has been found since the last eviction.
+     */
+    mutable int64_t lastRollingFeeUpdate;
+    mutable bool blockSinceLastRollingFeeBump;
+    mutable double rollingMinimumFeeRate; //! minimum fee to get into the pool, decreases exponentially
+
+    void trackPackageRemoved(const CFeeRate& rate);
+
 public:
+    //! Half-life of the rolling minimum fee rate, in seconds
+    static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12;
+
+    typedef boost::multi_index_container<
+        CTxMemPoolEntry,
+        boost::multi_index::indexed_by<
+            // sorted by txid
+            boost::multi_index::hashed_unique<mempoolentry_txid, CCoinsKeyHasher>,
+            // sorted by fee rate with descendants
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<descendant_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByDescendantScore
+            >,
+            // sorted by fee rate with ancestors
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<ancestor_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByAncestorScore
+            >,
+            // sorted by entry time
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<entry_time>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByEntryTime
+            >
+        >
+    > indexed_transaction_set;
+    typedef indexed_transaction_set::nth_index<0>::type::iterator txiter;
+
     mutable CCriticalSection cs;
-    std::map<uint256, CTxMemPoolEntry> mapTx;
+    indexed_transaction_set mapTx;
     std::map<COutPoint, CInPoint> mapNextTx;
     std::map<uint256, const CTransaction*> mapNullifiers;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
 
+private:
+    //! Link a new entry with the pool transactions it spends from and that spend from it
+    void LinkEntry(txiter it);
+    //! Remove an entry from the links of its parents and children
+    void UnlinkEntry(txiter it);
+    void AddLink(const CTxMemPoolEntry& parent, const CTxMemPoolEntry& child);
+    //! Add a newly linked entry to the package state of its ancestors and descendants, and theirs to its own
+    void UpdateForAdd(txiter it);
+    //! Take an entry out of the package state of its ancestors, and of its descendants if they stay
+    void UpdateForRemove(txiter it, bool fUpdateDescendants);
+    //! Recompute the package state of an entry from its links
+    void RecomputePackageState(txiter it);
+
+public:
     CTxMemPool(const CFeeRate& _minRelayFee);
     ~CTxMemPool();
 
@@ -126,6 +337,8 @@ public:
                         std::list<CTransaction>& conflicts, bool fCurrentEstimate = true);
     void clear();
     void queryHashes(std::vector<uint256>& vtxid);
+    //! The anchors that JoinSplits of transactions in the pool refer to
+    void queryAnchors(std::set<uint256>& setAnchors);
     void pruneSpent(const uint256& hash, CCoins &coins);
     unsigned int GetTransactionsUpdated() const;
     void AddTransactionsUpdated(unsigned int n);
@@ -135,6 +348,36 @@ public:
      */
     bool HasNoInputsOf(const CTransaction& tx) const;
 
+    /**
+     * Add the in-pool ancestors of entry, not entry itself, to setAncestors.
+     * If fSearchForParents is true, entry need not be in the pool yet, and its
+     * parents are looked up from its inputs. Returns false, with errString
+     * set, if adding entry would take a package beyond the given limits.
+     */
+    bool CalculateMemPoolAncestors(const CTxMemPoolEntry& entry, CTxMemPoolEntry::Links& setAncestors,
+                                   uint64_t limitAncestorCount, uint64_t limitAncestorSize,
+                                   uint64_t limitDescendantCount, uint64_t limitDescendantSize,
+                                   std::string& errString, bool fSearchForParents = true) const;
+
+    //! Add the in-pool descendants of entry, not entry itself, to setDescendants
+    void CalculateDescendants(const CTxMemPoolEntry& entry, CTxMemPoolEntry::Links& setDescendants) const;
+
+    /**
+     * The minimum fee rate to get into the pool, which rises above
+     * ::minRelayTxFee once transactions had to be evicted to keep the pool
+     * within sizelimit bytes.
+     */
+    CFeeRate GetMinFee(size_t sizelimit) const;
+
+    /**
+     * Remove transactions with the lowest descendant score, along with their
+     * descendants, until the pool uses at most sizelimit bytes of memory.
+     */
+    void TrimToSize(size_t sizelimit);
+
+    /** Remove transactions that entered the pool before time, and their descendants. Returns the number removed. */
+    int Expire(int64_t time);
+
     /** Affect CreateNewBlock prioritisation of transactions */
     void PrioritiseTransaction(const uint256 hash, const std::string strHash, double dPriorityDelta, const CAmount& nFeeDelta);
     void ApplyDeltas(const uint256 hash, double &dPriorityDelta, CAmount &nFeeDelta);
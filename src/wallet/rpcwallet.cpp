@@ -2529,6 +2529,10 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
             "  }\n"
             "  ...\n"
             "]\n"
+            "\n"
+            "solveequihash samples also have \"solutions\", \"solutionspersecond\" and\n"
+            "\"solverarenabytes\", the size of the buffer holding the first-phase lists\n"
+            "of the solver (not its peak memory use).\n"
             );
     }
 
@@ -2542,6 +2546,9 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
     }
 
     std::vector<double> sample_times;
+    std::vector<double> sample_pool_chunks;
+    std::vector<size_t> sample_solutions;
+    std::vector<size_t> sample_arena_bytes;
 
     JSDescription samplejoinsplit;
 
@@ -2570,23 +2577,40 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
 #ifdef ENABLE_MINING
         } else if (benchmarktype == "solveequihash") {
             if (params.size() < 3) {
-                sample_times.push_back(benchmark_solve_equihash());
+                size_t nSolutions, nArenaBytes;
+                sample_times.push_back(benchmark_solve_equihash(nSolutions, nArenaBytes));
+                sample_solutions.push_back(nSolutions);
+                sample_arena_bytes.push_back(nArenaBytes);
             } else {
                 int nThreads = params[2].get_int();
-                std::vector<double> vals = benchmark_solve_equihash_threaded(nThreads);
+                std::vector<size_t> vSolutions, vArenaBytes;
+                std::vector<double> vals = benchmark_solve_equihash_threaded(nThreads, vSolutions, vArenaBytes);
                 sample_times.insert(sample_times.end(), vals.begin(), vals.end());
+                sample_solutions.insert(sample_solutions.end(), vSolutions.begin(), vSolutions.end());
+                sample_arena_bytes.insert(sample_arena_bytes.end(), vArenaBytes.begin(), vArenaBytes.end());
             }
 #endif
         } else if (benchmarktype == "verifyequihash") {
             sample_times.push_back(benchmark_verify_equihash());
         } else if (benchmarktype == "validatelargetx") {
             sample_times.push_back(benchmark_large_tx());
+        } else if (benchmarktype == "verifyjoinsplitsigs") {
+            int nTxs = params[2].get_int();
+            sample_times.push_back(benchmark_verify_joinsplit_sigs(nTxs));
         } else if (benchmarktype == "trydecryptnotes") {
             int nAddrs = params[2].get_int();
             sample_times.push_back(benchmark_try_decrypt_notes(nAddrs));
         } else if (benchmarktype == "incnotewitnesses") {
             int nTxs = params[2].get_int();
             sample_times.push_back(benchmark_increment_note_witnesses(nTxs));
+        } else if (benchmarktype == "connectcoins") {
+            int nInputs = params[2].get_int();
+            if (nInputs <= 0) {
+                throw JSONRPCError(RPC_TYPE_ERROR, "Invalid number of inputs");
+            }
+            double poolChunksPerInput = 0;
+            sample_times.push_back(benchmark_connect_coins(nInputs, poolChunksPerInput));
+            sample_pool_chunks.push_back(poolChunksPerInput);
         } else if (benchmarktype == "connectblockslow") {
             if (Params().NetworkIDString() != "regtest") {
                 throw JSONRPCError(RPC_TYPE_ERROR, "Benchmark must be run in regtest mode");
@@ -2611,9 +2635,17 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
     }
 
     UniValue results(UniValue::VARR);
-    for (auto time : sample_times) {
+    for (size_t i = 0; i < sample_times.size(); i++) {
         UniValue result(UniValue::VOBJ);
-        result.push_back(Pair("runningtime", time));
+        result.push_back(Pair("runningtime", sample_times[i]));
+        if (i < sample_pool_chunks.size()) {
+            result.push_back(Pair("poolchunksperinput", sample_pool_chunks[i]));
+        }
+        if (i < sample_solutions.size()) {
+            result.push_back(Pair("solutions", (uint64_t)sample_solutions[i]));
+            result.push_back(Pair("solutionspersecond", sample_solutions[i] / sample_times[i]));
+            result.push_back(Pair("solverarenabytes", (uint64_t)sample_arena_bytes[i]));
+        }
         results.push_back(result);
     }
 
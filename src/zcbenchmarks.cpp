@@ -1,4 +1,5 @@
 #include <cstdio>
+#include <functional>
 #include <future>
 #include <map>
 #include <thread>
@@ -17,6 +18,7 @@
 #include "main.h"
 #include "miner.h"
 #include "pow.h"
+#include "random.h"
 #include "rpcserver.h"
 #include "script/sign.h"
 #include "sodium.h"
@@ -161,7 +163,7 @@ double benchmark_verify_joinsplit(const JSDescription &joinsplit)
 }
 
 #ifdef ENABLE_MINING
-double benchmark_solve_equihash()
+double benchmark_solve_equihash(size_t &nSolutions, size_t &nArenaBytes)
 {
     CBlock pblock;
     CEquihashInput I{pblock};
@@ -182,19 +184,27 @@ double benchmark_solve_equihash()
 
     struct timeval tv_start;
     timer_start(tv_start);
-    std::set<std::vector<unsigned int>> solns;
+    nSolutions = 0;
     EhOptimisedSolveUncancellable(n, k, eh_state,
-                                  [](std::vector<unsigned char> soln) { return false; });
-    return timer_stop(tv_start);
+                                  [&nSolutions](std::vector<unsigned char> soln) { nSolutions++; return false; });
+    double duration = timer_stop(tv_start);
+    nArenaBytes = EhSolverArenaSize();
+    // Don't leave the arena with the RPC thread that ran the benchmark
+    EhSolverArenaRelease();
+    return duration;
 }
 
-std::vector<double> benchmark_solve_equihash_threaded(int nThreads)
+std::vector<double> benchmark_solve_equihash_threaded(int nThreads, std::vector<size_t> &vSolutions, std::vector<size_t> &vArenaBytes)
 {
     std::vector<double> ret;
     std::vector<std::future<double>> tasks;
     std::vector<std::thread> threads;
+    vSolutions.assign(nThreads, 0);
+    vArenaBytes.assign(nThreads, 0);
     for (int i = 0; i < nThreads; i++) {
-        std::packaged_task<double(void)> task(&benchmark_solve_equihash);
+        std::packaged_task<double(void)> task(std::bind(&benchmark_solve_equihash,
+                                                        std::ref(vSolutions[i]),
+                                                        std::ref(vArenaBytes[i])));
         tasks.emplace_back(task.get_future());
         threads.emplace_back(std::move(task));
     }
@@ -283,6 +293,57 @@ double benchmark_large_tx()
     return timer_stop(tv_start);
 }
 
+// Creates a transaction with two JoinSplits (without proofs) and a valid joinSplitSig
+static CTransaction CreateSignedJoinSplitTx(uint64_t nNonce)
+{
+    CMutableTransaction mtx;
+    mtx.nVersion = 2;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout.hash = GetRandHash();
+    mtx.vin[0].prevout.n = 0;
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 0;
+    mtx.vjoinsplit.resize(2);
+    mtx.vjoinsplit[0].nullifiers.at(0) = GetRandHash();
+    mtx.vjoinsplit[0].nullifiers.at(1) = GetRandHash();
+    mtx.vjoinsplit[1].nullifiers.at(0) = GetRandHash();
+    mtx.vjoinsplit[1].nullifiers.at(1) = GetRandHash();
+    mtx.nLockTime = nNonce;
+
+    unsigned char joinSplitPrivKey[crypto_sign_SECRETKEYBYTES];
+    crypto_sign_keypair(mtx.joinSplitPubKey.begin(), joinSplitPrivKey);
+
+    // Empty output script.
+    CScript scriptCode;
+    CTransaction signTx(mtx);
+    uint256 dataToBeSigned = SignatureHash(scriptCode, signTx, NOT_AN_INPUT, SIGHASH_ALL);
+    assert(crypto_sign_detached(&mtx.joinSplitSig[0], NULL,
+                                dataToBeSigned.begin(), 32,
+                                joinSplitPrivKey) == 0);
+    return CTransaction(mtx);
+}
+
+double benchmark_verify_joinsplit_sigs(size_t nTxs)
+{
+    std::vector<CTransaction> vtx;
+    vtx.reserve(nTxs);
+    for (size_t i = 0; i < nTxs; i++) {
+        vtx.push_back(CreateSignedJoinSplitTx(i));
+    }
+
+    // Benchmark the checks CheckBlock performs on the transactions,
+    // including the joinSplitSig checks on the worker threads
+    struct timeval tv_start;
+    timer_start(tv_start);
+    CValidationState state;
+    std::vector<CJoinSplitSigCheck> vSigChecks;
+    for (const CTransaction& tx : vtx) {
+        assert(CheckTransactionWithoutProofVerification(tx, state, &vSigChecks));
+    }
+    assert(CheckJoinSplitSigs(vSigChecks, state));
+    return timer_stop(tv_start);
+}
+
 double benchmark_try_decrypt_notes(size_t nAddrs)
 {
     CWallet wallet;
@@ -397,6 +458,79 @@ public:
     }
 };
 
+// A cache that tells how many chunks and large blocks the pools of its maps
+// took from the heap. Allocations made by the CCoins entries themselves (their
+// vout and scripts) are not counted.
+class PoolCountingCoinsViewCache : public CCoinsViewCache {
+public:
+    PoolCountingCoinsViewCache(CCoinsView *baseIn) : CCoinsViewCache(baseIn) {}
+
+    uint64_t GetPoolAllocations() const {
+        return cacheCoins.get_allocator().GetResource().GetHeapAllocations() +
+               cacheAnchors.get_allocator().GetResource().GetHeapAllocations() +
+               cacheNullifiers.get_allocator().GetResource().GetHeapAllocations();
+    }
+};
+
+double benchmark_connect_coins(size_t nInputs, double &poolChunksPerInput)
+{
+    const size_t nInputsPerBlock = 1000;
+    CCoinsView dummy;
+    PoolCountingCoinsViewCache tip(&dummy);
+
+    // Outputs to spend, one per transaction
+    std::vector<uint256> vFunding;
+    for (size_t i = 0; i < nInputs; i++) {
+        CMutableTransaction funding;
+        funding.vin.resize(1);
+        funding.vin[0].prevout.n = i;
+        funding.vout.resize(1);
+        funding.vout[0].nValue = 1;
+        funding.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        CTransaction tx(funding);
+        tip.ModifyCoins(tx.GetHash())->FromTx(tx, 1);
+        vFunding.push_back(tx.GetHash());
+    }
+
+    // Blocks spending them
+    std::vector<std::vector<CTransaction>> blocks;
+    for (size_t i = 0; i < nInputs; ) {
+        std::vector<CTransaction> vtx;
+        for (; i < nInputs && vtx.size() < nInputsPerBlock; i++) {
+            CMutableTransaction spend;
+            spend.vin.resize(1);
+            spend.vin[0].prevout = COutPoint(vFunding[i], 0);
+            spend.vout.resize(2);
+            for (size_t j = 0; j < spend.vout.size(); j++) {
+                spend.vout[j].nValue = 1;
+                spend.vout[j].scriptPubKey = CScript() << OP_TRUE;
+            }
+            vtx.push_back(spend);
+        }
+        blocks.push_back(vtx);
+    }
+    uint64_t nTipChunks = tip.GetPoolAllocations();
+    uint64_t nChunks = 0;
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    for (size_t b = 0; b < blocks.size(); b++) {
+        PoolCountingCoinsViewCache view(&tip);
+        CValidationState state;
+        for (size_t i = 0; i < blocks[b].size(); i++) {
+            UpdateCoins(blocks[b][i], state, view, 2 + b);
+        }
+        nChunks += view.GetPoolAllocations();
+        assert(view.Flush());
+    }
+    auto duration = timer_stop(tv_start);
+
+    // Along with those the tip made while the blocks were connected
+    nChunks += tip.GetPoolAllocations() - nTipChunks;
+    poolChunksPerInput = (double)nChunks / nInputs;
+    return duration;
+}
+
 double benchmark_connectblock_slow()
 {
     // Test for issue 2017-05-01.a
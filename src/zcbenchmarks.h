@@ -8,13 +8,15 @@ extern double benchmark_sleep();
 extern double benchmark_parameter_loading();
 extern double benchmark_create_joinsplit();
 extern std::vector<double> benchmark_create_joinsplit_threaded(int nThreads);
-extern double benchmark_solve_equihash();
-extern std::vector<double> benchmark_solve_equihash_threaded(int nThreads);
+extern double benchmark_solve_equihash(size_t &nSolutions, size_t &nArenaBytes);
+extern std::vector<double> benchmark_solve_equihash_threaded(int nThreads, std::vector<size_t> &vSolutions, std::vector<size_t> &vArenaBytes);
 extern double benchmark_verify_joinsplit(const JSDescription &joinsplit);
 extern double benchmark_verify_equihash();
 extern double benchmark_large_tx();
+extern double benchmark_verify_joinsplit_sigs(size_t nTxs);
 extern double benchmark_try_decrypt_notes(size_t nAddrs);
 extern double benchmark_increment_note_witnesses(size_t nTxs);
+extern double benchmark_connect_coins(size_t nInputs, double &poolChunksPerInput);
 extern double benchmark_connectblock_slow();
 extern double benchmark_sendtoaddress(CAmount amount);
 extern double benchmark_loadwallet();